@@ -0,0 +1,263 @@
+#include "sfont/pcmconvert.h"
+#include "sfont/outputfile.h"
+#include "sfont/riffwriter.h"
+#include "sfont/sfont.h"
+#include "synthfont.h"
+
+#include <benchmark/benchmark.h>
+#include <filesystem>
+#include <cmath>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+//---------------------------------------------------------
+//   SoundFontBench
+//    Access to the private write steps
+//---------------------------------------------------------
+
+struct SoundFontBench {
+    static void writePdta(SoundFont &sf, RiffWriter *w) {
+        sf.out = w;
+        sf.writePdta();
+        sf.out = nullptr;
+    }
+    // A fresh encode of the stream every call, encodeStream only
+    // encodes a stream once
+    static size_t encode(SoundFont &sf, int stream) {
+        ChunkSink sink;
+        if (!sf.compressStream(sf.streams[stream], sink))
+            return 0;
+        return sink.size();
+    }
+};
+
+//---------------------------------------------------------
+//   synthFont
+//    Generated once per shape into the temp directory
+//---------------------------------------------------------
+
+static std::string synthFont(int samples, int minFrames, int maxFrames) {
+    fs::path path = fs::temp_directory_path() / ("sf3bench-" + std::to_string(samples) + "-" +
+                                                 std::to_string(minFrames) + "-" +
+                                                 std::to_string(maxFrames) + ".sf2");
+    if (!fs::exists(path)) {
+        SynthFontOptions o;
+        o.samples = samples;
+        o.minFrames = minFrames;
+        o.maxFrames = maxFrames;
+        o.instruments = std::max(1, samples / 4);
+        o.presets = o.instruments;
+        if (!writeSynthFont(path.string(), o))
+            throw std::runtime_error("cannot write " + path.string());
+    }
+    return path.string();
+}
+
+static fs::path outputPath() { return fs::temp_directory_path() / "sf3bench-out.sf3"; }
+
+//---------------------------------------------------------
+//   BM_Read
+//    Parse of a font with range(0) samples
+//---------------------------------------------------------
+
+static void BM_Read(benchmark::State &state) {
+    std::string path = synthFont(state.range(0), 1000, 1000);
+    for (auto _ : state) {
+        SoundFont sf(path);
+        if (!sf.read())
+            state.SkipWithError("read failed");
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Read)->Arg(64)->Arg(1024)->Arg(8192);
+
+//---------------------------------------------------------
+//   BM_ReadMetadata
+//    Fast open of the same fonts, as the preset command does
+//---------------------------------------------------------
+
+static void BM_ReadMetadata(benchmark::State &state) {
+    std::string path = synthFont(state.range(0), 1000, 1000);
+    for (auto _ : state) {
+        SoundFont sf(path);
+        if (!sf.readMetadata(true))
+            state.SkipWithError("read failed");
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ReadMetadata)->Arg(64)->Arg(1024)->Arg(8192);
+
+//---------------------------------------------------------
+//   BM_WritePdta
+//---------------------------------------------------------
+
+static void BM_WritePdta(benchmark::State &state) {
+    std::string path = synthFont(state.range(0), 1000, 1000);
+    SoundFont sf(path);
+    if (!sf.read()) {
+        state.SkipWithError("read failed");
+        return;
+    }
+    std::ostringstream out;
+    for (auto _ : state) {
+        out.str("");
+        RiffWriter w(&out);
+        SoundFontBench::writePdta(sf, &w);
+        w.close();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_WritePdta)->Arg(64)->Arg(1024)->Arg(8192);
+
+//---------------------------------------------------------
+//   BM_EncodeSample
+//    One mono sample of range(0) frames
+//---------------------------------------------------------
+
+static void BM_EncodeSample(benchmark::State &state) {
+    int frames = state.range(0);
+    std::string path = synthFont(1, frames, frames);
+    SoundFont sf(path);
+    WriteOptions options;
+    options.oggQuality = 0.3;
+    if (!sf.read() || !sf.prepare(options)) {
+        state.SkipWithError("read failed");
+        return;
+    }
+    for (auto _ : state) {
+        if (!SoundFontBench::encode(sf, 0)) {
+            state.SkipWithError("encode failed");
+            return;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * frames);
+}
+BENCHMARK(BM_EncodeSample)->Arg(4096)->Arg(44100)->Arg(441000)->Unit(benchmark::kMillisecond);
+
+//---------------------------------------------------------
+//   BM_EncodeBlockSize
+//    441000 frames fed range(0) frames at a time
+//---------------------------------------------------------
+
+static void BM_EncodeBlockSize(benchmark::State &state) {
+    std::string path = synthFont(1, 441000, 441000);
+    SoundFont sf(path);
+    WriteOptions options;
+    options.oggQuality = 0.3;
+    options.blockSize = state.range(0);
+    if (!sf.read() || !sf.prepare(options)) {
+        state.SkipWithError("read failed");
+        return;
+    }
+    for (auto _ : state) {
+        if (!SoundFontBench::encode(sf, 0)) {
+            state.SkipWithError("encode failed");
+            return;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * 441000);
+}
+BENCHMARK(BM_EncodeBlockSize)->RangeMultiplier(4)->Range(256, 65536)->Unit(benchmark::kMillisecond);
+
+//---------------------------------------------------------
+//   PCM to float kernels
+//    The loop compressSample used before pcmToFloat, the
+//    scalar fallback and the kernel chosen for this CPU
+//---------------------------------------------------------
+
+static std::vector<int16_t> randomPcm(size_t n) {
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> value(-32768, 32767);
+    std::vector<int16_t> pcm(n);
+    for (int16_t &v : pcm)
+        v = value(rng);
+    return pcm;
+}
+
+static void BM_PcmToFloatLegacy(benchmark::State &state) {
+    std::vector<int16_t> in = randomPcm(state.range(0));
+    std::vector<float> out(in.size());
+    double linearAmp = pow(10.0, 3.0 / 20.0);
+    for (auto _ : state) {
+        for (size_t i = 0; i < in.size(); ++i)
+            out[i] = (in[i] / 32768.f) * linearAmp;
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetItemsProcessed(state.iterations() * in.size());
+}
+BENCHMARK(BM_PcmToFloatLegacy)->Arg(1024)->Arg(65536);
+
+static void BM_PcmToFloatScalar(benchmark::State &state) {
+    std::vector<int16_t> in = randomPcm(state.range(0));
+    std::vector<float> out(in.size());
+    float gain = pow(10.0, 3.0 / 20.0) / 32768.0;
+    for (auto _ : state) {
+        pcmToFloatScalar(in.data(), out.data(), in.size(), gain);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetItemsProcessed(state.iterations() * in.size());
+}
+BENCHMARK(BM_PcmToFloatScalar)->Arg(1024)->Arg(65536);
+
+static void BM_PcmToFloat(benchmark::State &state) {
+    std::vector<int16_t> in = randomPcm(state.range(0));
+    std::vector<float> out(in.size());
+    float gain = pow(10.0, 3.0 / 20.0) / 32768.0;
+    state.SetLabel(pcmToFloatKernel());
+    for (auto _ : state) {
+        pcmToFloat(in.data(), out.data(), in.size(), gain);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetItemsProcessed(state.iterations() * in.size());
+}
+BENCHMARK(BM_PcmToFloat)->Arg(1024)->Arg(65536);
+
+//---------------------------------------------------------
+//   BM_Convert
+//    Read and write of 64 samples on range(0) threads,
+//    0 using all cores
+//---------------------------------------------------------
+
+static void BM_Convert(benchmark::State &state) {
+    std::string path = synthFont(64, 4000, 44100);
+    WriteOptions options;
+    options.oggQuality = 0.3;
+    options.jobs = state.range(0);
+    for (auto _ : state) {
+        SoundFont sf(path);
+        std::fstream out(outputPath(), std::ios::out | std::ios::binary);
+        if (!sf.read() || !sf.write(&out, options))
+            state.SkipWithError("convert failed");
+    }
+    state.SetBytesProcessed(state.iterations() * fs::file_size(path));
+}
+BENCHMARK(BM_Convert)->Arg(1)->Arg(0)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+//---------------------------------------------------------
+//   BM_ConvertPositional
+//    BM_Convert writing the file with positional writes
+//---------------------------------------------------------
+
+static void BM_ConvertPositional(benchmark::State &state) {
+    std::string path = synthFont(64, 4000, 44100);
+    WriteOptions options;
+    options.oggQuality = 0.3;
+    options.jobs = state.range(0);
+    for (auto _ : state) {
+        SoundFont sf(path);
+        OutputFile out;
+        if (!out.open(outputPath()) || !sf.read() || !sf.write(&out, options))
+            state.SkipWithError("convert failed");
+    }
+    state.SetBytesProcessed(state.iterations() * fs::file_size(path));
+}
+BENCHMARK(BM_ConvertPositional)
+    ->Arg(1)
+    ->Arg(0)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,32 @@
+#include "synthfont.h"
+
+#include <CLI/CLI.hpp>
+
+int main(int argc, char *argv[]) {
+    CLI::App cli("Generate a synthetic SoundFont2 file for benchmarking");
+    SynthFontOptions o;
+    std::string path = "";
+    cli.add_option("-n,--samples", o.samples, "Number of samples")->check(CLI::PositiveNumber);
+    cli.add_option("--min-frames", o.minFrames, "Shortest sample")->check(CLI::PositiveNumber);
+    cli.add_option("--max-frames", o.maxFrames, "Longest sample")->check(CLI::PositiveNumber);
+    cli.add_option("--stereo", o.stereoRatio, "Share of samples in stereo pairs")
+        ->check(CLI::Range(0.0, 1.0));
+    cli.add_flag("--right-first", o.rightFirst, "List stereo pairs right sample first");
+    cli.add_option("--instruments", o.instruments, "Number of instruments")
+        ->check(CLI::PositiveNumber);
+    cli.add_option("--zones", o.zonesPerInstrument, "Zones per instrument")
+        ->check(CLI::Range(1, 128));
+    cli.add_option("--presets", o.presets, "Number of presets")->check(CLI::PositiveNumber);
+    cli.add_option("--seed", o.seed, "Random seed");
+    cli.add_option("output-soundfont", path)->required();
+    try {
+        cli.parse(argc, argv);
+    } catch (const CLI::ParseError &e) {
+        return cli.exit(e);
+    }
+    if (!writeSynthFont(path, o)) {
+        fprintf(stderr, "Failed to write SoundFont: %s\n", path.c_str());
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,200 @@
+#include "synthfont.h"
+#include "sfont/riffwriter.h"
+#include "sfont/sfont.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <vector>
+
+//---------------------------------------------------------
+//   writeName
+//---------------------------------------------------------
+
+static void writeName(RiffWriter &w, const std::string &name) {
+    char buffer[20]{};
+    strncpy(buffer, name.c_str(), 19);
+    w.write(buffer, 20);
+}
+
+//---------------------------------------------------------
+//   tone
+//---------------------------------------------------------
+
+static std::vector<int16_t> tone(int frames, double freq, std::mt19937 &rng) {
+    std::normal_distribution<double> noise(0.0, 60.0);
+    std::vector<int16_t> pcm(frames);
+    for (int i = 0; i < frames; ++i) {
+        double t = i / 44100.0;
+        double v = 0;
+        for (int h = 1; h <= 4; ++h)
+            v += sin(2 * M_PI * freq * h * t) / h;
+        v = v * 9000 * exp(-2.0 * t) + noise(rng);
+        pcm[i] = (int16_t)std::clamp(v, -32768.0, 32767.0);
+    }
+    return pcm;
+}
+
+//---------------------------------------------------------
+//   writeSynthFont
+//---------------------------------------------------------
+
+bool writeSynthFont(const std::string &path, const SynthFontOptions &o) {
+    std::ofstream f(path, std::ios::out | std::ios::binary);
+    if (!f)
+        return false;
+    std::mt19937 rng(o.seed);
+    std::uniform_int_distribution<int> length(o.minFrames, std::max(o.minFrames, o.maxFrames));
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+    // Sample layout: lengths and stereo links, left before right
+    // unless rightFirst
+    struct Shdr {
+        int frames;
+        int link;
+        int type;
+    };
+    std::vector<Shdr> shdr;
+    while ((int)shdr.size() < o.samples) {
+        int frames = length(rng);
+        int idx = shdr.size();
+        if (idx + 1 < o.samples && unit(rng) < o.stereoRatio) {
+            shdr.push_back({frames, idx + 1, o.rightFirst ? 2 : 4});
+            shdr.push_back({frames, idx, o.rightFirst ? 4 : 2});
+        } else
+            shdr.push_back({frames, 0, 1});
+    }
+
+    RiffWriter w(&f);
+    try {
+        size_t riff = w.beginChunk("RIFF");
+        w.write("sfbk", 4);
+
+        size_t list = w.beginChunk("LIST");
+        w.write("INFO", 4);
+        size_t chunk = w.beginChunk("ifil");
+        w.writeWord(2);
+        w.writeWord(1);
+        w.endChunk(chunk);
+        chunk = w.beginChunk("isng");
+        w.write("EMU8000", 8);
+        w.endChunk(chunk);
+        chunk = w.beginChunk("INAM");
+        w.write("Synthetic", 10);
+        w.endChunk(chunk);
+        w.endChunk(list);
+
+        list = w.beginChunk("LIST");
+        w.write("sdta", 4);
+        chunk = w.beginChunk("smpl");
+        static const int16_t silence[46] = {};
+        std::vector<unsigned> start;
+        unsigned pos = 0;
+        for (size_t i = 0; i < shdr.size(); ++i) {
+            double freq = 55.0 * pow(2.0, (i % 48) / 12.0);
+            std::vector<int16_t> pcm = tone(shdr[i].frames, freq, rng);
+            w.write((const char *)pcm.data(), pcm.size() * 2);
+            w.write((const char *)silence, sizeof(silence));
+            start.push_back(pos);
+            pos += shdr[i].frames + 46;
+        }
+        w.endChunk(chunk);
+        w.endChunk(list);
+
+        list = w.beginChunk("LIST");
+        w.write("pdta", 4);
+
+        chunk = w.beginChunk("phdr");
+        for (int i = 0; i <= o.presets; ++i) {
+            writeName(w, i < o.presets ? "Preset " + std::to_string(i) : "EOP");
+            w.writeWord(i % 128);
+            w.writeWord(i / 128);
+            w.writeWord(i);
+            w.writeDword(0);
+            w.writeDword(0);
+            w.writeDword(0);
+        }
+        w.endChunk(chunk);
+        chunk = w.beginChunk("pbag");
+        for (int i = 0; i <= o.presets; ++i) {
+            w.writeWord(i);
+            w.writeWord(0);
+        }
+        w.endChunk(chunk);
+        chunk = w.beginChunk("pmod");
+        w.write((const char *)silence, 10);
+        w.endChunk(chunk);
+        chunk = w.beginChunk("pgen");
+        for (int i = 0; i < o.presets; ++i) {
+            w.writeWord(Gen_Instrument);
+            w.writeWord(i % std::max(1, o.instruments));
+        }
+        w.writeDword(0);
+        w.endChunk(chunk);
+
+        int zones = o.instruments * o.zonesPerInstrument;
+        chunk = w.beginChunk("inst");
+        for (int i = 0; i <= o.instruments; ++i) {
+            writeName(w, i < o.instruments ? "Instrument " + std::to_string(i) : "EOI");
+            w.writeWord(i * o.zonesPerInstrument);
+        }
+        w.endChunk(chunk);
+        chunk = w.beginChunk("ibag");
+        for (int i = 0; i <= zones; ++i) {
+            w.writeWord(i * 3);
+            w.writeWord(0);
+        }
+        w.endChunk(chunk);
+        chunk = w.beginChunk("imod");
+        w.write((const char *)silence, 10);
+        w.endChunk(chunk);
+        chunk = w.beginChunk("igen");
+        int keys = 128 / std::max(1, o.zonesPerInstrument);
+        for (int i = 0; i < zones; ++i) {
+            int zone = i % o.zonesPerInstrument;
+            w.writeWord(Gen_KeyRange);
+            unsigned char range[2] = {(unsigned char)(zone * keys),
+                                      (unsigned char)std::min(127, zone * keys + keys - 1)};
+            w.write((const char *)range, 2);
+            w.writeWord(Gen_OverrideRootKey);
+            w.writeWord(zone * keys + keys / 2);
+            w.writeWord(Gen_SampleId);
+            w.writeWord(i % std::max(1, o.samples));
+        }
+        w.writeDword(0);
+        w.endChunk(chunk);
+
+        chunk = w.beginChunk("shdr");
+        for (size_t i = 0; i <= shdr.size(); ++i) {
+            if (i == shdr.size()) {
+                writeName(w, "EOS");
+                w.write((const char *)silence, 26);
+                break;
+            }
+            unsigned s = start[i];
+            unsigned e = s + shdr[i].frames;
+            writeName(w, "Sample " + std::to_string(i));
+            w.writeDword(s);
+            w.writeDword(e);
+            w.writeDword(s + shdr[i].frames / 4);
+            w.writeDword(e - 8);
+            w.writeDword(44100);
+            unsigned char pitch[2] = {60, 0};
+            w.write((const char *)pitch, 2);
+            w.writeWord(shdr[i].link);
+            w.writeWord(shdr[i].type);
+        }
+        w.endChunk(chunk);
+        w.endChunk(list);
+
+        w.endChunk(riff);
+        w.close();
+    } catch (std::string s) {
+        fprintf(stderr, "write synthetic font failed: %s\n", s.c_str());
+        return false;
+    }
+    return true;
+}
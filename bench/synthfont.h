@@ -0,0 +1,29 @@
+#pragma once
+#include <string>
+
+//---------------------------------------------------------
+//   SynthFontOptions
+//---------------------------------------------------------
+
+struct SynthFontOptions {
+    int samples{64};
+    int minFrames{4000};
+    int maxFrames{44100};
+    double stereoRatio{0.25}; // share of samples in linked stereo pairs
+    bool rightFirst{false};   // stereo pairs listed right sample first
+    int instruments{16};
+    int zonesPerInstrument{4};
+    int presets{16};
+    unsigned seed{1};
+};
+
+//---------------------------------------------------------
+//   writeSynthFont
+//    Write a SoundFont2 file of decaying harmonic tones with
+//    a little noise, so encoding costs about what real
+//    instrument samples cost. Every preset plays one
+//    instrument, whose zones split the keyboard across
+//    consecutive samples.
+//---------------------------------------------------------
+
+bool writeSynthFont(const std::string &path, const SynthFontOptions &);
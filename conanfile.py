@@ -15,6 +15,7 @@ class CompressorRecipe(ConanFile):
         self.tool_requires("doxygen/1.9.4")
         self.tool_requires("ninja/1.12.1")
         self.test_requires("gtest/1.15.0")
+        self.test_requires("benchmark/1.9.0")
 
     def requirements(self):
         self.requires("cli11/2.4.2")
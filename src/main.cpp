@@ -1,14 +1,229 @@
+#include "sfont/batch.h"
+#include "sfont/outputfile.h"
+#include "sfont/previousfont.h"
+#include "sfont/samplecache.h"
 #include "sfont/sfont.h"
+#include "sfont/stats.h"
+#include "sfont/verify.h"
 
 #include <CLI/CLI.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <streambuf>
 
-SoundFont readSoundFont(const char *soundFontPath) {
-    SoundFont soundFont(soundFontPath);
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+void readSoundFont(SoundFont &soundFont, const char *soundFontPath) {
     if (!soundFont.read()) {
         fprintf(stderr, "Failed to read input SoundFont: %s\n", soundFontPath);
         exit(3);
     }
-    return soundFont;
+}
+
+// Unbuffered streambuf writing to a FILE
+class FileBuf : public std::streambuf {
+    FILE *file;
+
+  protected:
+    std::streamsize xsputn(const char *s, std::streamsize n) override {
+        return fwrite(s, 1, n, file);
+    }
+    int overflow(int c) override { return c == EOF ? 0 : fputc(c, file); }
+    int sync() override { return fflush(file); }
+
+  public:
+    FileBuf(FILE *f) : file(f) {}
+};
+
+// Keep the original stdout for SoundFont data and send everything printed
+// to stdout to stderr instead, so the two cannot mix
+FILE *takeStdout() {
+    fflush(stdout);
+#ifdef _WIN32
+    int fd = _dup(_fileno(stdout));
+    if (fd < 0)
+        return nullptr;
+    _setmode(fd, _O_BINARY);
+    _dup2(_fileno(stderr), _fileno(stdout));
+    return _fdopen(fd, "wb");
+#else
+    int fd = dup(STDOUT_FILENO);
+    if (fd < 0)
+        return nullptr;
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    return fdopen(fd, "wb");
+#endif
+}
+
+// Output SoundFont file, or stdout for "-". A regular file is written with
+// positional writes, output that cannot seek back, like stdout or a pipe,
+// in streaming mode. A file that is also read while writing, `keep`, is
+// replaced only once the new one is complete.
+struct OutputSoundFont {
+    OutputFile file;
+    std::string target; // file replaced by the completed output
+    std::fstream special;
+    FILE *pipe = nullptr;
+    std::unique_ptr<FileBuf> pipeBuf;
+    std::unique_ptr<std::ostream> pipeStream;
+    std::ostream *stream = nullptr;
+    bool streaming = false;
+
+    void open(const std::string &path, const std::string &keep = "") {
+        if (path == "-") {
+            pipe = takeStdout();
+            if (!pipe) {
+                fprintf(stderr, "Failed to setup output SoundFont on stdout\n");
+                exit(2);
+            }
+            pipeBuf = std::make_unique<FileBuf>(pipe);
+            pipeStream = std::make_unique<std::ostream>(pipeBuf.get());
+            stream = pipeStream.get();
+            streaming = true;
+            return;
+        }
+        std::error_code ec;
+        if (!std::filesystem::exists(path, ec) || std::filesystem::is_regular_file(path, ec)) {
+            if (!keep.empty() && std::filesystem::equivalent(path, keep, ec))
+                target = path;
+            if (!file.open(target.empty() ? path : path + ".part")) {
+                fprintf(stderr, "Failed to setup output SoundFont: %s\n", path.c_str());
+                exit(2);
+            }
+            return;
+        }
+        special.open(path, std::fstream::out | std::fstream::binary);
+        if (!special) {
+            fprintf(stderr, "Failed to setup output SoundFont: %s\n", path.c_str());
+            exit(2);
+        }
+        stream = &special;
+        streaming = true;
+    }
+
+    bool write(SoundFont &soundFont, const WriteOptions &options) {
+        if (stream)
+            return soundFont.write(stream, options);
+        return soundFont.write(&file, options);
+    }
+
+    bool close() {
+        if (pipe)
+            return fclose(pipe) == 0;
+        if (stream) {
+            special.close();
+            return !special.fail();
+        }
+        bool ok = file.close();
+        if (!target.empty()) {
+            std::error_code ec;
+            if (ok)
+                std::filesystem::rename(file.name(), target, ec);
+            else
+                std::filesystem::remove(file.name(), ec);
+            ok = ok && !ec;
+        }
+        return ok;
+    }
+};
+
+// Options shared by convert and convert-batch
+struct ConvertSettings {
+    WriteOptions options;
+    std::string cacheDir = "";
+    int cacheSize = 4096; // MiB
+    int maxMemory = 0;    // MiB
+    std::unique_ptr<SampleCache> cache;
+    std::string updatePath = "";
+    std::unique_ptr<PreviousFont> previous;
+    std::string statsPath = "";
+    Stats stats;
+};
+
+void addConvertOptions(CLI::App *app, ConvertSettings &settings) {
+    WriteOptions &options = settings.options;
+    app->add_option("-q", options.oggQuality, "Ogg quality")->check(CLI::Range(0.0, 1.0));
+    app->add_option("-a", options.oggAmp, "Amplify sample dB")->check(CLI::Range(-60.0, 60.0));
+    app->add_option("--target-snr", options.targetSnr,
+                    "Give each sample the lowest quality reaching this SNR in dB, instead of -q")
+        ->check(CLI::Range(1.0, 150.0));
+    app->add_option("--target-size", options.targetSize,
+                    "Choose sample qualities to fit the output in this many bytes, instead of -q")
+        ->check(CLI::PositiveNumber);
+    app->add_option("-j", options.jobs, "Encoding threads, 0 uses all cores")
+        ->check(CLI::Range(0, 1024));
+    app->add_option("--block-size", options.blockSize, "Frames fed to the encoder at a time")
+        ->check(CLI::Range(64, 1 << 20));
+    app->add_flag("-s,--joint-stereo", options.jointStereo,
+                  "Encode linked stereo samples as one 2 channel stream");
+    app->add_flag("--dedup,!--no-dedup", options.dedupe,
+                  "Encode identical sample data once and share it (default)");
+    app->add_flag("--prune", options.prune, "Drop instruments and samples no preset uses");
+    app->add_option("--cache", settings.cacheDir, "Directory caching encoded samples across runs");
+    app->add_option("--cache-size", settings.cacheSize, "Sample cache size limit in MiB")
+        ->check(CLI::PositiveNumber);
+}
+
+// Per-phase and per-sample timings of a single conversion
+void addStatsOption(CLI::App *app, ConvertSettings &settings) {
+    app->add_option("--stats", settings.statsPath, "Write timings and sample sizes to a JSON file");
+}
+
+// Memory budget of the encode pipeline of a single conversion
+void addMemoryOption(CLI::App *app, ConvertSettings &settings) {
+    app->add_option("--max-memory", settings.maxMemory,
+                    "Limit sample data being encoded or waiting to be written to this many MiB")
+        ->check(CLI::PositiveNumber);
+}
+
+void setMemoryLimit(ConvertSettings &settings) {
+    settings.options.maxMemory = (size_t)settings.maxMemory * 1024 * 1024;
+}
+
+void writeStats(ConvertSettings &settings) {
+    if (!settings.statsPath.empty() && !settings.stats.write(settings.statsPath))
+        exit(2);
+}
+
+void openCache(ConvertSettings &settings) {
+    if (settings.cacheDir.empty())
+        return;
+    settings.cache = std::make_unique<SampleCache>(settings.cacheDir,
+                                                   (uint64_t)settings.cacheSize * 1024 * 1024);
+    if (!settings.cache->open())
+        exit(2);
+    settings.options.cache = settings.cache.get();
+}
+
+void closeCache(ConvertSettings &settings) {
+    if (!settings.cache)
+        return;
+    settings.cache->trim();
+    settings.cache->report();
+}
+
+void openPrevious(ConvertSettings &settings) {
+    if (settings.updatePath.empty())
+        return;
+    settings.previous = std::make_unique<PreviousFont>(settings.updatePath);
+    if (!settings.previous->open())
+        exit(2);
+    settings.options.update = settings.previous.get();
+}
+
+void closePrevious(ConvertSettings &settings) {
+    if (!settings.previous)
+        return;
+    settings.previous->report();
+    settings.options.update = nullptr;
+    settings.previous.reset();
 }
 
 int main(int argc, char *argv[]) {
@@ -18,41 +233,257 @@ int main(int argc, char *argv[]) {
     cli.set_help_all_flag("-h", "Print this help message and exit");
 
     CLI::App *convertCli = cli.add_subcommand("convert", "Convert SoundFont2 to SoundFont3");
+    ConvertSettings convertSettings;
     {
-        double oggQuality = 0;
-        double oggDbAmp = 0;
         std::string inputSoundFontPath = "";
         std::string outputSoundFontPath = "";
-        convertCli->add_option("-q", oggQuality, "Ogg quality")->check(CLI::Range(0.0, 1.0));
-        convertCli->add_option("-a", oggDbAmp, "Amplify sample dB")->check(CLI::Range(-60.0, 60.0));
+        addConvertOptions(convertCli, convertSettings);
+        addStatsOption(convertCli, convertSettings);
+        addMemoryOption(convertCli, convertSettings);
+        convertCli->add_option("--update", convertSettings.updatePath,
+                               "Copy unchanged samples from this earlier SoundFont3 output");
         convertCli->add_option("input-soundfont", inputSoundFontPath)->required();
         convertCli->add_option("output-soundfont", outputSoundFontPath)->required();
-        convertCli->callback([&oggQuality, &oggDbAmp, &inputSoundFontPath, &outputSoundFontPath]() {
+        convertCli->callback([&convertSettings, &inputSoundFontPath, &outputSoundFontPath]() {
+            OutputSoundFont newSoundFont;
+            newSoundFont.open(outputSoundFontPath, convertSettings.updatePath);
+            convertSettings.options.streaming = newSoundFont.streaming;
+            setMemoryLimit(convertSettings);
+            printf("Converting SoundFont: %s to %s\n", inputSoundFontPath.c_str(), outputSoundFontPath.c_str());
+            SoundFont soundFont(inputSoundFontPath);
+            if (!convertSettings.statsPath.empty())
+                soundFont.setStats(&convertSettings.stats);
+            readSoundFont(soundFont, inputSoundFontPath.c_str());
+            openCache(convertSettings);
+            openPrevious(convertSettings);
+            bool ok = newSoundFont.write(soundFont, convertSettings.options);
+            closePrevious(convertSettings);
+            ok = newSoundFont.close() && ok;
+            closeCache(convertSettings);
+            writeStats(convertSettings);
+            exit(ok ? 0 : 3);
+        });
+    }
+
+    CLI::App *batchCli =
+        cli.add_subcommand("convert-batch", "Convert many SoundFont2 files on one thread pool");
+    ConvertSettings batchSettings;
+    batchSettings.options.jobs = 0;
+    {
+        std::string inputDir = "";
+        std::string outputDir = "";
+        std::vector<std::string> soundFontPaths;
+        addConvertOptions(batchCli, batchSettings);
+        batchCli->add_option("-i,--input-dir", inputDir, "Convert every .sf2 in this directory")
+            ->check(CLI::ExistingDirectory);
+        batchCli->add_option("-o,--output-dir", outputDir, "Output directory for --input-dir");
+        batchCli->add_option("soundfonts", soundFontPaths, "Input and output SoundFont pairs");
+        batchCli->callback([&batchSettings, &inputDir, &outputDir, &soundFontPaths]() {
+            std::vector<BatchJob> jobs;
+            if (soundFontPaths.size() % 2) {
+                fprintf(stderr, "Expected input and output SoundFont pairs\n");
+                exit(1);
+            }
+            for (size_t i = 0; i < soundFontPaths.size(); i += 2)
+                jobs.push_back({soundFontPaths[i], soundFontPaths[i + 1]});
+            if (!inputDir.empty()) {
+                namespace fs = std::filesystem;
+                fs::path out = outputDir.empty() ? fs::path(inputDir) : fs::path(outputDir);
+                fs::create_directories(out);
+                std::vector<fs::path> inputs;
+                for (const fs::directory_entry &entry : fs::directory_iterator(inputDir)) {
+                    std::string ext = entry.path().extension().string();
+                    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+                    if (entry.is_regular_file() && ext == ".sf2")
+                        inputs.push_back(entry.path());
+                }
+                std::sort(inputs.begin(), inputs.end());
+                for (const fs::path &input : inputs)
+                    jobs.push_back(
+                        {input.string(), (out / input.stem()).replace_extension(".sf3").string()});
+            }
+            if (jobs.empty()) {
+                fprintf(stderr, "No SoundFonts to convert\n");
+                exit(1);
+            }
+            openCache(batchSettings);
+            int failures = convertBatch(jobs, batchSettings.options);
+            closeCache(batchSettings);
+            printf("Converted %d of %d SoundFonts\n", (int)jobs.size() - failures,
+                   (int)jobs.size());
+            exit(failures ? 3 : 0);
+        });
+    }
+
+    CLI::App *extractCli =
+        cli.add_subcommand("extract", "Convert selected presets of a SoundFont2 to SoundFont3");
+    ConvertSettings extractSettings;
+    {
+        std::string inputSoundFontPath = "";
+        std::string outputSoundFontPath = "";
+        std::vector<std::string> presetArgs;
+        addConvertOptions(extractCli, extractSettings);
+        addStatsOption(extractCli, extractSettings);
+        addMemoryOption(extractCli, extractSettings);
+        extractCli
+            ->add_option("-p,--preset", presetArgs,
+                         "Preset index as listed by the preset command, or bank:program")
+            ->required();
+        extractCli->add_option("input-soundfont", inputSoundFontPath)->required();
+        extractCli->add_option("output-soundfont", outputSoundFontPath)->required();
+        extractCli->callback([&extractSettings, &inputSoundFontPath, &outputSoundFontPath,
+                              &presetArgs]() {
+            OutputSoundFont newSoundFont;
+            newSoundFont.open(outputSoundFontPath);
+            extractSettings.options.streaming = newSoundFont.streaming;
+            setMemoryLimit(extractSettings);
+            SoundFont soundFont(inputSoundFontPath);
+            if (!extractSettings.statsPath.empty())
+                soundFont.setStats(&extractSettings.stats);
+            readSoundFont(soundFont, inputSoundFontPath.c_str());
+            std::vector<int> presetIdx;
+            for (const std::string &arg : presetArgs) {
+                int idx = -1;
+                int bank, program;
+                char rest;
+                if (sscanf(arg.c_str(), "%d:%d%c", &bank, &program, &rest) == 2)
+                    idx = soundFont.findPreset(bank, program);
+                else if (sscanf(arg.c_str(), "%d%c", &idx, &rest) != 1)
+                    idx = -1;
+                if (idx < 0 || idx >= soundFont.presetCount()) {
+                    fprintf(stderr, "No such preset: %s\n", arg.c_str());
+                    exit(1);
+                }
+                presetIdx.push_back(idx);
+            }
+            soundFont.extract(presetIdx);
+            printf("Extracting %d presets, %d samples: %s to %s\n", soundFont.presetCount(),
+                   soundFont.sampleCount(), inputSoundFontPath.c_str(),
+                   outputSoundFontPath.c_str());
+            openCache(extractSettings);
+            bool ok = newSoundFont.write(soundFont, extractSettings.options);
+            ok = newSoundFont.close() && ok;
+            closeCache(extractSettings);
+            writeStats(extractSettings);
+            exit(ok ? 0 : 3);
+        });
+    }
+
+    CLI::App *decompressCli =
+        cli.add_subcommand("decompress", "Convert SoundFont3 back to SoundFont2");
+    {
+        std::string inputSoundFontPath = "";
+        std::string outputSoundFontPath = "";
+        int jobs = 0;
+        decompressCli->add_option("-j", jobs, "Decoding threads, 0 uses all cores")
+            ->check(CLI::Range(0, 1024));
+        decompressCli->add_option("input-soundfont", inputSoundFontPath)->required();
+        decompressCli->add_option("output-soundfont", outputSoundFontPath)->required();
+        decompressCli->callback([&inputSoundFontPath, &outputSoundFontPath, &jobs]() {
+            SoundFont soundFont(inputSoundFontPath);
+            readSoundFont(soundFont, inputSoundFontPath.c_str());
+            if (!soundFont.isCompressed()) {
+                fprintf(stderr, "Not a compressed SoundFont: %s\n", inputSoundFontPath.c_str());
+                exit(3);
+            }
             std::fstream newSoundFont;
-            newSoundFont.open(outputSoundFontPath, std::fstream::out);
+            newSoundFont.open(outputSoundFontPath, std::fstream::out | std::fstream::binary);
             if (!newSoundFont) {
                 fprintf(stderr, "Failed to setup output SoundFont: %s\n",
                         outputSoundFontPath.c_str());
                 exit(2);
             }
-            printf("Converting SoundFont: %s to %s\n", inputSoundFontPath.c_str(), outputSoundFontPath.c_str());
-            readSoundFont(inputSoundFontPath.c_str()).write(&newSoundFont, oggQuality, oggDbAmp);
+            printf("Decompressing SoundFont: %s to %s\n", inputSoundFontPath.c_str(),
+                   outputSoundFontPath.c_str());
+            bool ok = soundFont.decompress(&newSoundFont, jobs);
             newSoundFont.close();
-            exit(0);
+            exit(ok ? 0 : 3);
         });
     }
 
     CLI::App *presetCli = cli.add_subcommand("preset", "Dump SoundFont preset names");
     {
-        std::string inputSoundFontPath = "";
-        presetCli->add_option("input-soundfont", inputSoundFontPath)->required();
-        presetCli->callback([&inputSoundFontPath]() {
-            printf("Dump SoundFont presets for: %s\n", inputSoundFontPath.c_str());
-            readSoundFont(inputSoundFontPath.c_str()).dumpPresets();
-            exit(0);
+        std::vector<std::string> inputs;
+        bool json = false;
+        bool info = false;
+        presetCli->add_option("input-soundfont", inputs,
+                              "SoundFonts, or directories searched for .sf2 and .sf3 files")
+            ->required();
+        presetCli->add_flag("--json", json, "Print one line of JSON per SoundFont");
+        presetCli->add_flag("--info", info, "Also print the version and INFO strings");
+        presetCli->callback([&inputs, &json, &info]() {
+            namespace fs = std::filesystem;
+            std::vector<std::string> soundFontPaths;
+            for (const std::string &input : inputs) {
+                std::error_code ec;
+                if (!fs::is_directory(input, ec)) {
+                    soundFontPaths.push_back(input);
+                    continue;
+                }
+                std::vector<std::string> found;
+                for (const fs::directory_entry &entry : fs::recursive_directory_iterator(
+                         input, fs::directory_options::skip_permission_denied, ec)) {
+                    std::string ext = entry.path().extension().string();
+                    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+                    if (entry.is_regular_file(ec) && (ext == ".sf2" || ext == ".sf3"))
+                        found.push_back(entry.path().string());
+                }
+                std::sort(found.begin(), found.end());
+                soundFontPaths.insert(soundFontPaths.end(), found.begin(), found.end());
+            }
+            int failures = 0;
+            for (const std::string &path : soundFontPaths) {
+                SoundFont soundFont(path);
+                if (!soundFont.readMetadata(info)) {
+                    fprintf(stderr, "Failed to read input SoundFont: %s\n", path.c_str());
+                    ++failures;
+                    continue;
+                }
+                if (json) {
+                    soundFont.dumpPresetsJson(info);
+                    continue;
+                }
+                printf("Dump SoundFont presets for: %s\n", path.c_str());
+                if (info)
+                    soundFont.dumpInfo();
+                soundFont.dumpPresets();
+            }
+            exit(failures ? 3 : 0);
         });
     }
 
+    CLI::App *verifyCli =
+        cli.add_subcommand("verify", "Check a converted SoundFont against its source");
+    {
+        std::string inputSoundFontPath = "";
+        std::string outputSoundFontPath = "";
+        std::string jsonPath = "";
+        int jobs = 0;
+        Verifier::Limits limits;
+        verifyCli->add_option("-j", jobs, "Decoding threads, 0 uses all cores")
+            ->check(CLI::Range(0, 1024));
+        verifyCli->add_option("--min-snr", limits.minSnr,
+                              "Fail samples below this signal to noise ratio in dB");
+        verifyCli->add_option("--max-loop-jump", limits.maxLoopJump,
+                              "Fail samples whose loop point jumps by more than this much "
+                              "more than in the source")
+            ->check(CLI::NonNegativeNumber);
+        verifyCli->add_option("-a", limits.amp, "Amplification in dB the output was made with")
+            ->check(CLI::Range(-60.0, 60.0));
+        verifyCli->add_option("--json", jsonPath, "Write the per sample results to a JSON file");
+        verifyCli->add_option("input-soundfont", inputSoundFontPath)->required();
+        verifyCli->add_option("output-soundfont", outputSoundFontPath)->required();
+        verifyCli->callback(
+            [&inputSoundFontPath, &outputSoundFontPath, &jsonPath, &jobs, &limits]() {
+                Verifier verifier(inputSoundFontPath, outputSoundFontPath);
+                bool ok = verifier.run(jobs, limits);
+                verifier.report();
+                if (!jsonPath.empty() && !verifier.writeJson(jsonPath))
+                    exit(2);
+                exit(ok ? 0 : 3);
+            });
+    }
+
     cli.require_subcommand();
     try {
         cli.parse(argc, argv);
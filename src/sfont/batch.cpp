@@ -0,0 +1,168 @@
+#include "batch.h"
+#include "taskpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+//---------------------------------------------------------
+//   BatchFont
+//---------------------------------------------------------
+
+struct BatchFont {
+    const BatchJob *job;
+    std::unique_ptr<SoundFont> font;
+    std::atomic<int> remaining{0}; // streams still to encode
+    std::atomic<bool> failed{false};
+};
+
+//---------------------------------------------------------
+//   Batch
+//    Fonts are opened in order as earlier ones finish, at
+//    most window of them at a time, so only their sample
+//    data and encoded streams are held. Each font queues its
+//    streams longest first behind those of the fonts opened
+//    before it. The pool is the only set of threads: fonts
+//    are prepared and written with jobs = 1, so the quality
+//    search and the write of the encoded streams run serially
+//    inside their task.
+//---------------------------------------------------------
+
+struct Batch {
+    const std::vector<BatchJob> &jobs;
+    WriteOptions options; // per font
+    TaskPool pool;
+    std::vector<BatchFont> fonts;
+    std::atomic<size_t> next{0};
+    std::atomic<int> failures{0};
+
+    Batch(const std::vector<BatchJob> &j, const WriteOptions &o)
+        : jobs(j), options(o), pool(o.jobs), fonts(j.size()) {
+        options.jobs = 1;
+    }
+
+    void openNext();
+    void openFont(BatchFont *);
+    void encode(BatchFont *, int stream);
+    void finishFont(BatchFont *);
+};
+
+//---------------------------------------------------------
+//   openNext
+//    Queue the reading of the next font, if any is left
+//---------------------------------------------------------
+
+void Batch::openNext() {
+    size_t idx = next++;
+    if (idx >= jobs.size())
+        return;
+    BatchFont *f = &fonts[idx];
+    f->job = &jobs[idx];
+    pool.submit([this, f] { openFont(f); });
+}
+
+//---------------------------------------------------------
+//   openFont
+//    Read and prepare a font and queue its streams
+//---------------------------------------------------------
+
+void Batch::openFont(BatchFont *f) {
+    bool ok = false;
+    try {
+        f->font = std::make_unique<SoundFont>(f->job->input);
+        ok = f->font->read() && f->font->prepare(options);
+    } catch (...) {
+    }
+    if (!ok) {
+        fprintf(stderr, "Failed to read input SoundFont: %s\n", f->job->input.c_str());
+        ++failures;
+        f->font.reset();
+        openNext();
+        return;
+    }
+    int n = f->font->streamCount();
+    if (n == 0) {
+        finishFont(f);
+        return;
+    }
+    // Longest first, so the pool does not end the font on one long sample
+    std::vector<std::pair<size_t, int>> order;
+    for (int i = 0; i < n; ++i)
+        order.push_back({f->font->streamFrames(i), i});
+    std::stable_sort(order.begin(), order.end(),
+                     [](const auto &a, const auto &b) { return a.first > b.first; });
+    f->remaining = n;
+    for (const auto &[frames, stream] : order)
+        pool.submit([this, f, stream] { encode(f, stream); });
+}
+
+//---------------------------------------------------------
+//   encode
+//    Encode one stream, and finish the font after its last.
+//    Errors only fail the font they belong to.
+//---------------------------------------------------------
+
+void Batch::encode(BatchFont *f, int stream) {
+    if (!f->failed) {
+        try {
+            f->font->encodeStream(stream);
+        } catch (const std::string &s) {
+            fprintf(stderr, "%s: %s\n", f->job->input.c_str(), s.c_str());
+            f->failed = true;
+        } catch (const std::exception &e) {
+            fprintf(stderr, "%s: %s\n", f->job->input.c_str(), e.what());
+            f->failed = true;
+        } catch (...) {
+            fprintf(stderr, "%s: encoding failed\n", f->job->input.c_str());
+            f->failed = true;
+        }
+    }
+    if (--f->remaining == 0)
+        finishFont(f);
+}
+
+//---------------------------------------------------------
+//   finishFont
+//    Write out a font whose streams are all encoded, release
+//    it and open the next
+//---------------------------------------------------------
+
+void Batch::finishFont(BatchFont *f) {
+    bool ok = !f->failed;
+    if (ok) {
+        std::fstream out(f->job->output, std::fstream::out | std::fstream::binary);
+        if (!out) {
+            fprintf(stderr, "Failed to setup output SoundFont: %s\n", f->job->output.c_str());
+            ok = false;
+        } else {
+            try {
+                ok = f->font->writePrepared(&out);
+            } catch (...) {
+                ok = false;
+            }
+            out.close();
+        }
+    }
+    if (ok)
+        printf("Converted SoundFont: %s to %s\n", f->job->input.c_str(), f->job->output.c_str());
+    else {
+        fprintf(stderr, "Failed to convert SoundFont: %s\n", f->job->input.c_str());
+        ++failures;
+    }
+    f->font.reset();
+    openNext();
+}
+
+//---------------------------------------------------------
+//   convertBatch
+//---------------------------------------------------------
+
+int convertBatch(const std::vector<BatchJob> &jobs, const WriteOptions &options) {
+    Batch batch(jobs, options);
+    // One font per thread keeps every thread busy when fonts are small
+    int window = std::max(2, batch.pool.size());
+    for (int i = 0; i < window; ++i)
+        batch.openNext();
+    batch.pool.wait();
+    return batch.failures;
+}
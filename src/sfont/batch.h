@@ -0,0 +1,26 @@
+#pragma once
+#include "sfont.h"
+
+#include <string>
+#include <vector>
+
+//---------------------------------------------------------
+//   BatchJob
+//---------------------------------------------------------
+
+struct BatchJob {
+    std::string input;
+    std::string output;
+};
+
+//---------------------------------------------------------
+//   convertBatch
+//    Convert every job on one shared TaskPool of
+//    options.jobs threads. Fonts are read in order as the
+//    pool gets to them, with about one open per thread; the
+//    samples of each are encoded longest first, and a font
+//    is written out and released as soon as its last sample
+//    is done. Returns the number of fonts that failed.
+//---------------------------------------------------------
+
+int convertBatch(const std::vector<BatchJob> &jobs, const WriteOptions &options);
@@ -0,0 +1,73 @@
+#include "decodecache.h"
+
+//---------------------------------------------------------
+//   get
+//    The cached stream for key, calling decode on a miss.
+//    Decoding runs outside the lock.
+//---------------------------------------------------------
+
+std::shared_ptr<const DecodedStream>
+DecodeCache::get(uint64_t key, const std::function<DecodedStream()> &decode) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        if (it != index.end()) {
+            entries.splice(entries.begin(), entries, it->second);
+            ++hits;
+            return it->second->stream;
+        }
+        ++misses;
+    }
+
+    auto stream = std::make_shared<const DecodedStream>(decode());
+    size_t streamBytes = 0;
+    for (const std::vector<int16_t> &channel : *stream)
+        streamBytes += channel.size() * sizeof(int16_t);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(key);
+    if (it != index.end()) // decoded meanwhile by another thread
+        return it->second->stream;
+    entries.push_front({key, stream, streamBytes});
+    index[key] = entries.begin();
+    bytes += streamBytes;
+    // The newest entry stays even if it alone exceeds the bound
+    while (bytes > maxBytes && entries.size() > 1) {
+        const Entry &last = entries.back();
+        bytes -= last.bytes;
+        index.erase(last.key);
+        entries.pop_back();
+    }
+    return stream;
+}
+
+//---------------------------------------------------------
+//   clear
+//---------------------------------------------------------
+
+void DecodeCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+    index.clear();
+    bytes = 0;
+}
+
+//---------------------------------------------------------
+//   size
+//    Bytes of PCM held
+//---------------------------------------------------------
+
+size_t DecodeCache::size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return bytes;
+}
+
+//---------------------------------------------------------
+//   counts
+//---------------------------------------------------------
+
+void DecodeCache::counts(int *h, int *m) {
+    std::lock_guard<std::mutex> lock(mutex);
+    *h = hits;
+    *m = misses;
+}
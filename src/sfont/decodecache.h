@@ -0,0 +1,46 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// PCM of one decoded Ogg stream, one vector per channel
+typedef std::vector<std::vector<int16_t>> DecodedStream;
+
+//---------------------------------------------------------
+//   DecodeCache
+//    In-memory LRU of decoded sample streams, bounded by the
+//    bytes of PCM it holds. Entries are handed out as shared
+//    pointers, so evicting one never invalidates PCM a caller
+//    still uses. Safe to use from several threads; a stream
+//    missed by two threads at once may be decoded twice.
+//---------------------------------------------------------
+
+class DecodeCache {
+    struct Entry {
+        uint64_t key;
+        std::shared_ptr<const DecodedStream> stream;
+        size_t bytes;
+    };
+
+    size_t maxBytes;
+    size_t bytes{0};
+    std::list<Entry> entries; // most recently used first
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+    std::mutex mutex;
+
+    int hits{0};
+    int misses{0};
+
+  public:
+    DecodeCache(size_t maxBytes) : maxBytes(maxBytes) {}
+
+    std::shared_ptr<const DecodedStream> get(uint64_t key,
+                                             const std::function<DecodedStream()> &decode);
+    void clear();
+    size_t size();
+    void counts(int *hits, int *misses);
+};
@@ -0,0 +1,10 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+//---------------------------------------------------------
+//   hash64
+//    XXH64 of n bytes at p
+//---------------------------------------------------------
+
+uint64_t hash64(const void *p, size_t n, uint64_t seed = 0);
@@ -0,0 +1,213 @@
+#include "oggdecoder.h"
+
+#include <vorbis/codec.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+//---------------------------------------------------------
+//   toPcm
+//    Inverse of the scaling compressSample applies
+//---------------------------------------------------------
+
+static int16_t toPcm(float v) {
+    long s = lrintf(v * 32768.f);
+    return s > 32767 ? 32767 : s < -32768 ? -32768 : s;
+}
+
+//---------------------------------------------------------
+//   decodeOgg
+//---------------------------------------------------------
+
+bool decodeOgg(std::span<const char> data, std::vector<std::vector<int16_t>> *channels) {
+    channels->clear();
+
+    ogg_sync_state oy;
+    ogg_stream_state os;
+    ogg_page og;
+    ogg_packet op;
+    vorbis_info vi;
+    vorbis_comment vc;
+    vorbis_dsp_state vd;
+    vorbis_block vb;
+
+    ogg_sync_init(&oy);
+    vorbis_info_init(&vi);
+    vorbis_comment_init(&vc);
+    char *buffer = ogg_sync_buffer(&oy, data.size());
+    memcpy(buffer, data.data(), data.size());
+    ogg_sync_wrote(&oy, data.size());
+
+    bool streamInit = false;
+    int headers = 0;
+    bool ok = true;
+    while (ok && ogg_sync_pageout(&oy, &og) == 1) {
+        if (!streamInit) {
+            ogg_stream_init(&os, ogg_page_serialno(&og));
+            streamInit = true;
+        }
+        if (ogg_stream_pagein(&os, &og) < 0) {
+            ok = false;
+            break;
+        }
+        int result;
+        while ((result = ogg_stream_packetout(&os, &op)) != 0) {
+            if (result < 0) // hole in the data, skip it
+                continue;
+            if (headers < 3) {
+                if (vorbis_synthesis_headerin(&vi, &vc, &op) < 0) {
+                    ok = false;
+                    break;
+                }
+                if (++headers == 3) {
+                    vorbis_synthesis_init(&vd, &vi);
+                    vorbis_block_init(&vd, &vb);
+                    channels->resize(vi.channels);
+                }
+                continue;
+            }
+            if (vorbis_synthesis(&vb, &op) == 0)
+                vorbis_synthesis_blockin(&vd, &vb);
+            float **pcm;
+            int n;
+            while ((n = vorbis_synthesis_pcmout(&vd, &pcm)) > 0) {
+                for (int c = 0; c < vi.channels; ++c) {
+                    std::vector<int16_t> &out = (*channels)[c];
+                    for (int i = 0; i < n; ++i)
+                        out.push_back(toPcm(pcm[c][i]));
+                }
+                vorbis_synthesis_read(&vd, n);
+            }
+        }
+    }
+
+    if (headers == 3) {
+        vorbis_block_clear(&vb);
+        vorbis_dsp_clear(&vd);
+    }
+    if (streamInit)
+        ogg_stream_clear(&os);
+    vorbis_comment_clear(&vc);
+    vorbis_info_clear(&vi);
+    ogg_sync_clear(&oy);
+    return ok && headers == 3;
+}
+
+//---------------------------------------------------------
+//   nextPage
+//    Skips any garbage in front of the page
+//---------------------------------------------------------
+
+static bool nextPage(ogg_sync_state *oy, ogg_page *og) {
+    int result;
+    while ((result = ogg_sync_pageout(oy, og)) < 0)
+        ;
+    return result == 1;
+}
+
+//---------------------------------------------------------
+//   probeOgg
+//    The identification and comment headers come first, on
+//    the first one or two pages. The last page is searched
+//    for in a short tail of the data, then in the longest
+//    tail a page can span.
+//---------------------------------------------------------
+
+static const size_t probeChunk = 4096;
+static const size_t maxPageSize = 27 + 255 + 255 * 255;
+
+bool probeOgg(std::span<const char> data, OggProbe *probe) {
+    ogg_sync_state oy;
+    ogg_stream_state os;
+    ogg_page og;
+    ogg_packet op;
+    vorbis_info vi;
+    vorbis_comment vc;
+    ogg_sync_init(&oy);
+    vorbis_info_init(&vi);
+    vorbis_comment_init(&vc);
+    bool started = false;
+    int serial = 0;
+    bool bad = false;
+    int headers = 0;
+    for (size_t pos = 0; !bad && headers < 2 && pos < data.size();) {
+        size_t n = std::min(data.size() - pos, probeChunk);
+        memcpy(ogg_sync_buffer(&oy, n), data.data() + pos, n);
+        ogg_sync_wrote(&oy, n);
+        pos += n;
+        while (!bad && headers < 2 && nextPage(&oy, &og)) {
+            if (!started) {
+                serial = ogg_page_serialno(&og);
+                ogg_stream_init(&os, serial);
+                started = true;
+            }
+            if (ogg_stream_pagein(&os, &og) != 0)
+                continue; // another stream
+            while (!bad && headers < 2 && ogg_stream_packetout(&os, &op) == 1) {
+                bad = vorbis_synthesis_headerin(&vi, &vc, &op) != 0;
+                ++headers;
+            }
+        }
+    }
+    bool ok = !bad && headers == 2;
+    if (ok) {
+        probe->serial = serial;
+        probe->channels = vi.channels;
+        probe->samplerate = vi.rate;
+        const char *key = vorbis_comment_query(&vc, streamKeyTag, 0);
+        probe->key = key ? strtoull(key, nullptr, 16) : 0;
+    }
+    if (started)
+        ogg_stream_clear(&os);
+    vorbis_comment_clear(&vc);
+    vorbis_info_clear(&vi);
+    ogg_sync_clear(&oy);
+    if (!ok)
+        return false;
+
+    for (size_t tail : {probeChunk, maxPageSize}) {
+        tail = std::min(tail, data.size());
+        ogg_sync_init(&oy);
+        memcpy(ogg_sync_buffer(&oy, tail), data.data() + data.size() - tail, tail);
+        ogg_sync_wrote(&oy, tail);
+        bool eos = false;
+        while (!eos && nextPage(&oy, &og)) {
+            if (ogg_page_serialno(&og) == probe->serial && ogg_page_eos(&og)) {
+                probe->frames = ogg_page_granulepos(&og);
+                eos = true;
+            }
+        }
+        ogg_sync_clear(&oy);
+        if (eos)
+            return true;
+        if (tail == data.size())
+            break;
+    }
+    return false;
+}
+
+//---------------------------------------------------------
+//   isCompleteOgg
+//    Pages are only counted while no byte is skipped, so any
+//    hole or garbage leaves the total short of the data
+//---------------------------------------------------------
+
+bool isCompleteOgg(std::span<const char> data) {
+    if (data.empty())
+        return false;
+    ogg_sync_state oy;
+    ogg_page og;
+    ogg_sync_init(&oy);
+    memcpy(ogg_sync_buffer(&oy, data.size()), data.data(), data.size());
+    ogg_sync_wrote(&oy, data.size());
+    size_t pages = 0;
+    bool eos = false;
+    while (!eos && ogg_sync_pageout(&oy, &og) == 1) {
+        pages += og.header_len + og.body_len;
+        eos = ogg_page_eos(&og);
+    }
+    ogg_sync_clear(&oy);
+    return eos && pages == data.size();
+}
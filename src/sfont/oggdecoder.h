@@ -0,0 +1,47 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <vector>
+
+//---------------------------------------------------------
+//   decodeOgg
+//    Decode one Ogg Vorbis stream to 16 bit PCM, one vector
+//    per channel. Returns false if the stream is not valid
+//    Vorbis.
+//---------------------------------------------------------
+
+bool decodeOgg(std::span<const char> data, std::vector<std::vector<int16_t>> *channels);
+
+//---------------------------------------------------------
+//   streamKeyTag
+//    Vorbis comment holding the key of a stream, as 16 hex
+//    digits, see SoundFont::streamKey
+//---------------------------------------------------------
+
+inline constexpr const char *streamKeyTag = "SFTOOLS_KEY";
+
+//---------------------------------------------------------
+//   probeOgg
+//    Serial, channels, rate and key from the headers of an
+//    Ogg Vorbis stream and its length in frames from the
+//    last page, without decoding. Returns false if the
+//    headers or the last page are missing.
+//---------------------------------------------------------
+
+struct OggProbe {
+    int serial{0};
+    uint64_t key{0}; // 0 for streams without a key
+    int channels{0};
+    long samplerate{0};
+    int64_t frames{0};
+};
+
+bool probeOgg(std::span<const char> data, OggProbe *probe);
+
+//---------------------------------------------------------
+//   isCompleteOgg
+//    True if data is a run of whole Ogg pages, from its
+//    first byte to its last, ending in an end of stream page
+//---------------------------------------------------------
+
+bool isCompleteOgg(std::span<const char> data);
@@ -0,0 +1,33 @@
+#include "oggsink.h"
+
+#include <algorithm>
+
+//---------------------------------------------------------
+//   ChunkSink
+//---------------------------------------------------------
+
+void ChunkSink::append(const char *p, size_t n) {
+    while (n) {
+        if (chunks.empty() || chunks.back().size() == chunks.back().capacity()) {
+            chunks.emplace_back();
+            chunks.back().reserve(chunkSize);
+        }
+        std::vector<char> &chunk = chunks.back();
+        size_t len = std::min(n, chunk.capacity() - chunk.size());
+        chunk.insert(chunk.end(), p, p + len);
+        p += len;
+        n -= len;
+    }
+}
+
+//---------------------------------------------------------
+//   take
+//    Hand the collected chunks over and start empty again
+//---------------------------------------------------------
+
+OggChunks ChunkSink::take() {
+    OggChunks result;
+    result.swap(chunks);
+    written = 0;
+    return result;
+}
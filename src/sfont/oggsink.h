@@ -0,0 +1,61 @@
+#pragma once
+#include "riffwriter.h"
+
+#include <cstddef>
+#include <vector>
+
+//---------------------------------------------------------
+//   OggSink
+//    Destination for the pages of one compressed sample.
+//    size() counts the bytes written since construction
+//    or the last take().
+//---------------------------------------------------------
+
+class OggSink {
+  protected:
+    size_t written{0};
+    virtual void append(const char *p, size_t n) = 0;
+
+  public:
+    virtual ~OggSink() = default;
+    void write(const char *p, size_t n) {
+        append(p, n);
+        written += n;
+    }
+    size_t size() const { return written; }
+};
+
+//---------------------------------------------------------
+//   WriterSink
+//    Writes pages straight to the output
+//---------------------------------------------------------
+
+class WriterSink : public OggSink {
+    RiffWriter *out;
+
+  protected:
+    void append(const char *p, size_t n) override { out->write(p, n); }
+
+  public:
+    WriterSink(RiffWriter *o) : out(o) {}
+};
+
+//---------------------------------------------------------
+//   ChunkSink
+//    Collects pages in a list of heap chunks that grows with
+//    the compressed size, for samples encoded ahead of the
+//    point where they can be written out.
+//---------------------------------------------------------
+
+typedef std::vector<std::vector<char>> OggChunks;
+
+class ChunkSink : public OggSink {
+    OggChunks chunks;
+
+  protected:
+    void append(const char *p, size_t n) override;
+
+  public:
+    static const size_t chunkSize = 64 * 1024;
+    OggChunks take();
+};
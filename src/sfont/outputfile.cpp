@@ -0,0 +1,146 @@
+#include "outputfile.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+//---------------------------------------------------------
+//   OutputFile
+//---------------------------------------------------------
+
+OutputFile::~OutputFile() { close(); }
+
+#ifdef _WIN32
+
+//---------------------------------------------------------
+//   open
+//    Create or truncate the file
+//---------------------------------------------------------
+
+bool OutputFile::open(const std::string &p) {
+    close();
+    HANDLE file = CreateFileA(p.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    handle = file;
+    path = p;
+    return true;
+}
+
+//---------------------------------------------------------
+//   close
+//---------------------------------------------------------
+
+bool OutputFile::close() {
+    if (!handle)
+        return true;
+    bool ok = CloseHandle(handle);
+    handle = nullptr;
+    return ok;
+}
+
+bool OutputFile::isOpen() const { return handle != nullptr; }
+
+//---------------------------------------------------------
+//   preallocate
+//    Reserve the final size of the file up front
+//---------------------------------------------------------
+
+void OutputFile::preallocate(size_t size) {
+    LARGE_INTEGER end;
+    end.QuadPart = size;
+    if (!SetFilePointerEx(handle, end, nullptr, FILE_BEGIN) || !SetEndOfFile(handle))
+        throw(std::string("cannot allocate ") + path);
+}
+
+//---------------------------------------------------------
+//   writeAt
+//---------------------------------------------------------
+
+void OutputFile::writeAt(size_t pos, const char *p, size_t n) {
+    while (n) {
+        OVERLAPPED at = {};
+        at.Offset = DWORD(pos);
+        at.OffsetHigh = DWORD(uint64_t(pos) >> 32);
+        DWORD len = n > 0x40000000 ? 0x40000000 : DWORD(n);
+        DWORD written = 0;
+        if (!WriteFile(handle, p, len, &written, &at) || written == 0)
+            throw(std::string("write to ") + path + " failed");
+        pos += written;
+        p += written;
+        n -= written;
+    }
+}
+
+#else
+
+//---------------------------------------------------------
+//   open
+//    Create or truncate the file
+//---------------------------------------------------------
+
+bool OutputFile::open(const std::string &p) {
+    close();
+    fd = ::open(p.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0)
+        return false;
+    path = p;
+    return true;
+}
+
+//---------------------------------------------------------
+//   close
+//---------------------------------------------------------
+
+bool OutputFile::close() {
+    if (fd < 0)
+        return true;
+    bool ok = ::close(fd) == 0;
+    fd = -1;
+    return ok;
+}
+
+bool OutputFile::isOpen() const { return fd >= 0; }
+
+//---------------------------------------------------------
+//   preallocate
+//    Reserve the final size of the file up front. Where
+//    the file system cannot allocate, only set the size.
+//---------------------------------------------------------
+
+void OutputFile::preallocate(size_t size) {
+#ifdef __linux__
+    if (posix_fallocate(fd, 0, size) == 0)
+        return;
+#endif
+    if (ftruncate(fd, size) != 0)
+        throw(std::string("cannot allocate ") + path + ": " + strerror(errno));
+}
+
+//---------------------------------------------------------
+//   writeAt
+//---------------------------------------------------------
+
+void OutputFile::writeAt(size_t pos, const char *p, size_t n) {
+    while (n) {
+        ssize_t written = pwrite(fd, p, n, pos);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            throw(std::string("write to ") + path + " failed: " + strerror(errno));
+        pos += written;
+        p += written;
+        n -= written;
+    }
+}
+
+#endif
@@ -0,0 +1,35 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+//---------------------------------------------------------
+//   OutputFile
+//    Output file written with positional writes: every
+//    region goes straight to its final offset, so different
+//    threads can write different regions concurrently and
+//    nothing is ever patched by seeking back. Needs a
+//    seekable file, pipes go through a std::ostream instead.
+//---------------------------------------------------------
+
+class OutputFile {
+    std::string path;
+#ifdef _WIN32
+    void *handle{nullptr};
+#else
+    int fd{-1};
+#endif
+
+  public:
+    OutputFile() = default;
+    OutputFile(const OutputFile &) = delete;
+    OutputFile &operator=(const OutputFile &) = delete;
+    ~OutputFile();
+
+    bool open(const std::string &path);
+    bool close();
+    bool isOpen() const;
+    const std::string &name() const { return path; }
+
+    void preallocate(size_t size);
+    void writeAt(size_t pos, const char *p, size_t n);
+};
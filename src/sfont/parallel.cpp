@@ -0,0 +1,50 @@
+#include "parallel.h"
+
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//---------------------------------------------------------
+//   parallelFor
+//---------------------------------------------------------
+
+void parallelFor(int n, int jobs, const std::function<void(int)> &fn) {
+    if (jobs > n)
+        jobs = n;
+    if (jobs <= 1) {
+        for (int i = 0; i < n; ++i)
+            fn(i);
+        return;
+    }
+
+    std::atomic<int> next{0};
+    std::exception_ptr error;
+    std::mutex errorMutex;
+
+    auto worker = [&]() {
+        for (;;) {
+            int i = next++;
+            if (i >= n)
+                return;
+            try {
+                fn(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error)
+                    error = std::current_exception();
+                next = n; // stop handing out work
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 1; t < jobs; ++t)
+        threads.emplace_back(worker);
+    worker();
+    for (std::thread &t : threads)
+        t.join();
+    if (error)
+        std::rethrow_exception(error);
+}
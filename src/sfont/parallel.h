@@ -0,0 +1,12 @@
+#pragma once
+#include <functional>
+
+//---------------------------------------------------------
+//   parallelFor
+//    Call fn(i) for every i in [0, n) on up to `jobs` worker
+//    threads. Each worker claims the next unprocessed index,
+//    so long and short items balance out. The first exception
+//    thrown by fn is rethrown on the calling thread.
+//---------------------------------------------------------
+
+void parallelFor(int n, int jobs, const std::function<void(int)> &fn);
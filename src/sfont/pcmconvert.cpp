@@ -0,0 +1,150 @@
+#include "pcmconvert.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PCM_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+//---------------------------------------------------------
+//   pcmToFloatScalar
+//---------------------------------------------------------
+
+void pcmToFloatScalar(const int16_t *in, float *out, size_t n, float gain) {
+    for (size_t i = 0; i < n; ++i)
+        out[i] = std::clamp(in[i] * gain, -1.0f, 1.0f);
+}
+
+#ifdef PCM_X86
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET(t) __attribute__((target(t)))
+#else
+#define TARGET(t)
+#endif
+
+//---------------------------------------------------------
+//   pcmToFloatSse2
+//    8 samples per pass, sign extended by unpacking into the
+//    high halves and shifting down
+//---------------------------------------------------------
+
+TARGET("sse2")
+static void pcmToFloatSse2(const int16_t *in, float *out, size_t n, float gain) {
+    const __m128 g = _mm_set1_ps(gain);
+    const __m128 hi = _mm_set1_ps(1.0f);
+    const __m128 lo = _mm_set1_ps(-1.0f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+        __m128i a = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        __m128i b = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        __m128 fa = _mm_mul_ps(_mm_cvtepi32_ps(a), g);
+        __m128 fb = _mm_mul_ps(_mm_cvtepi32_ps(b), g);
+        _mm_storeu_ps(out + i, _mm_max_ps(_mm_min_ps(fa, hi), lo));
+        _mm_storeu_ps(out + i + 4, _mm_max_ps(_mm_min_ps(fb, hi), lo));
+    }
+    pcmToFloatScalar(in + i, out + i, n - i, gain);
+}
+
+//---------------------------------------------------------
+//   pcmToFloatAvx2
+//    16 samples per pass
+//---------------------------------------------------------
+
+TARGET("avx2")
+static void pcmToFloatAvx2(const int16_t *in, float *out, size_t n, float gain) {
+    const __m256 g = _mm256_set1_ps(gain);
+    const __m256 hi = _mm256_set1_ps(1.0f);
+    const __m256 lo = _mm256_set1_ps(-1.0f);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i + 8));
+        __m256 fa = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(a)), g);
+        __m256 fb = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(b)), g);
+        _mm256_storeu_ps(out + i, _mm256_max_ps(_mm256_min_ps(fa, hi), lo));
+        _mm256_storeu_ps(out + i + 8, _mm256_max_ps(_mm256_min_ps(fb, hi), lo));
+    }
+    pcmToFloatScalar(in + i, out + i, n - i, gain);
+}
+
+//---------------------------------------------------------
+//   hasAvx2
+//---------------------------------------------------------
+
+static bool hasAvx2() {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_cpu_supports("avx2");
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    bool osxsave = info[2] & (1 << 27);
+    bool avx = info[2] & (1 << 28);
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return info[1] & (1 << 5);
+#else
+    return false;
+#endif
+}
+
+static bool hasSse2() {
+#if defined(__x86_64__) || defined(_M_X64)
+    return true;
+#elif defined(__GNUC__) || defined(__clang__)
+    return __builtin_cpu_supports("sse2");
+#else
+    return false;
+#endif
+}
+
+#endif
+
+//---------------------------------------------------------
+//   Kernel selection
+//---------------------------------------------------------
+
+static PcmKernel chooseKernel() {
+#ifdef PCM_X86
+    if (hasAvx2())
+        return {pcmToFloatAvx2, "avx2"};
+    if (hasSse2())
+        return {pcmToFloatSse2, "sse2"};
+#endif
+    return {pcmToFloatScalar, "scalar"};
+}
+
+static const PcmKernel &kernel() {
+    static const PcmKernel choice = chooseKernel();
+    return choice;
+}
+
+void pcmToFloat(const int16_t *in, float *out, size_t n, float gain) {
+    kernel().fn(in, out, n, gain);
+}
+
+const char *pcmToFloatKernel() { return kernel().name; }
+
+//---------------------------------------------------------
+//   pcmToFloatKernels
+//---------------------------------------------------------
+
+std::vector<PcmKernel> pcmToFloatKernels() {
+    std::vector<PcmKernel> kernels = {{pcmToFloatScalar, "scalar"}};
+#ifdef PCM_X86
+    if (hasSse2())
+        kernels.push_back({pcmToFloatSse2, "sse2"});
+    if (hasAvx2())
+        kernels.push_back({pcmToFloatAvx2, "avx2"});
+#endif
+    return kernels;
+}
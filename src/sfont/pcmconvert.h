@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//---------------------------------------------------------
+//   pcmToFloat
+//    out[i] = clip(in[i] * gain) to [-1, 1], for n samples.
+//    Uses AVX2 or SSE2 where the CPU has them, checked once
+//    at first use, and a scalar loop otherwise.
+//---------------------------------------------------------
+
+void pcmToFloat(const int16_t *in, float *out, size_t n, float gain);
+void pcmToFloatScalar(const int16_t *in, float *out, size_t n, float gain);
+
+// Name of the kernel pcmToFloat uses: "avx2", "sse2" or "scalar"
+const char *pcmToFloatKernel();
+
+//---------------------------------------------------------
+//   pcmToFloatKernels
+//    Every kernel this CPU can run, scalar first, so tests
+//    can check each against the scalar loop
+//---------------------------------------------------------
+
+struct PcmKernel {
+    void (*fn)(const int16_t *in, float *out, size_t n, float gain);
+    const char *name;
+};
+
+std::vector<PcmKernel> pcmToFloatKernels();
@@ -0,0 +1,62 @@
+#include "previousfont.h"
+#include "oggdecoder.h"
+
+#include <cstdio>
+#include <set>
+
+//---------------------------------------------------------
+//   PreviousFont
+//---------------------------------------------------------
+
+PreviousFont::PreviousFont(const std::string &p) : path(p), font(p) {}
+
+//---------------------------------------------------------
+//   open
+//    Read the font and index its streams. Stereo pairs and
+//    deduplicated samples share a stream, which is indexed
+//    once.
+//---------------------------------------------------------
+
+bool PreviousFont::open() {
+    if (!font.read() || !font.isCompressed() || !font.openSamples(0)) {
+        fprintf(stderr, "cannot update <%s>: not a SoundFont 3 file\n", path.c_str());
+        return false;
+    }
+    std::set<const char *> indexed;
+    for (int i = 0; i < font.sampleCount(); ++i) {
+        std::span<const char> data = font.sampleStream(i);
+        if (data.empty() || !indexed.insert(data.data()).second)
+            continue;
+        OggProbe probe;
+        if (probeOgg(data, &probe) && probe.key)
+            streams.insert({probe.key, {data, probe.channels, probe.samplerate, probe.frames}});
+    }
+    return true;
+}
+
+//---------------------------------------------------------
+//   load
+//    Copy the matching stream to sink, if there is one
+//---------------------------------------------------------
+
+bool PreviousFont::load(uint64_t key, int channels, long samplerate, int64_t frames,
+                        OggSink &sink) {
+    auto it = streams.find(key);
+    if (it == streams.end())
+        return false;
+    const Stream &stream = it->second;
+    if (stream.channels != channels || stream.samplerate != samplerate || stream.frames != frames)
+        return false;
+    sink.write(stream.data.data(), stream.data.size());
+    ++hits;
+    hitBytes += stream.data.size();
+    return true;
+}
+
+//---------------------------------------------------------
+//   report
+//---------------------------------------------------------
+
+void PreviousFont::report() const {
+    printf("Update: %d streams copied, %.1f MB reused\n", (int)hits, hitBytes / 1048576.0);
+}
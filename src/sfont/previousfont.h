@@ -0,0 +1,42 @@
+#pragma once
+#include "oggsink.h"
+#include "sfont.h"
+
+#include <atomic>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <unordered_map>
+
+//---------------------------------------------------------
+//   PreviousFont
+//    The compressed streams of an earlier sf3 output, for
+//    updating it. Every stream carries a 64 bit key hashed
+//    from its sample data and encoder settings, so a stream
+//    with the key, channels, rate and length a new stream
+//    would get holds the same encode and is copied instead.
+//    Streams without a key are never reused. Safe to use
+//    from several encoder threads once open.
+//---------------------------------------------------------
+
+class PreviousFont {
+    struct Stream {
+        std::span<const char> data;
+        int channels;
+        long samplerate;
+        int64_t frames;
+    };
+
+    std::string path;
+    SoundFont font;
+    std::unordered_map<uint64_t, Stream> streams; // by key
+    std::atomic<int> hits{0};
+    std::atomic<uint64_t> hitBytes{0};
+
+  public:
+    PreviousFont(const std::string &path);
+
+    bool open();
+    bool load(uint64_t key, int channels, long samplerate, int64_t frames, OggSink &sink);
+    void report() const;
+};
@@ -0,0 +1,118 @@
+#include "riffindex.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+//---------------------------------------------------------
+//   readHeader
+//---------------------------------------------------------
+
+static void readHeader(std::istream *f, uint64_t pos, char *id, uint32_t *len) {
+    unsigned char header[8];
+    f->seekg(pos);
+    if (f->read((char *)header, 8).fail())
+        throw(std::string("unexpected end of file"));
+    memcpy(id, header, 4);
+    *len = header[4] | header[5] << 8 | header[6] << 16 | (uint32_t)header[7] << 24;
+}
+
+//---------------------------------------------------------
+//   build
+//    Throws if the file is not RIFF or a chunk runs past
+//    the end of its parent
+//---------------------------------------------------------
+
+void RiffIndex::build(std::istream *f) {
+    chunks.clear();
+    char id[4];
+    uint32_t len;
+    readHeader(f, 0, id, &len);
+    if (memcmp(id, "RIFF", 4) || len < 4)
+        throw(std::string("not a RIFF file"));
+    RiffChunk form{{}, true, 12, len - 4, -1};
+    if (f->read(form.id, 4).fail())
+        throw(std::string("unexpected end of file"));
+    chunks.push_back(form);
+    scan(f, 12, 8 + (uint64_t)len, 0);
+}
+
+//---------------------------------------------------------
+//   scan
+//    Chunks of odd length are followed by a pad byte
+//---------------------------------------------------------
+
+void RiffIndex::scan(std::istream *f, uint64_t pos, uint64_t end, int parent) {
+    while (pos + 8 <= end) {
+        RiffChunk chunk;
+        uint32_t len;
+        readHeader(f, pos, chunk.id, &len);
+        uint64_t next = pos + 8 + len;
+        if (next > end)
+            throw(std::string("chunk <") + std::string(chunk.id, 4) + "> runs past its parent");
+        chunk.parent = parent;
+        chunk.list = !memcmp(chunk.id, "LIST", 4) && len >= 4;
+        if (chunk.list) {
+            if (f->read(chunk.id, 4).fail())
+                throw(std::string("unexpected end of file"));
+            chunk.offset = pos + 12;
+            chunk.length = len - 4;
+        } else {
+            chunk.offset = pos + 8;
+            chunk.length = len;
+        }
+        chunks.push_back(chunk);
+        if (chunk.list)
+            scan(f, pos + 12, next, chunks.size() - 1);
+        pos = std::min(next + (len & 1), end);
+    }
+}
+
+//---------------------------------------------------------
+//   find
+//    Index of the first chunk or LIST with the given id,
+//    optionally only inside a LIST of the given type.
+//    -1 if there is none.
+//---------------------------------------------------------
+
+int RiffIndex::find(const char *id, const char *list) const {
+    for (int i = 0; i < (int)chunks.size(); ++i) {
+        const RiffChunk &chunk = chunks[i];
+        if (memcmp(chunk.id, id, 4))
+            continue;
+        if (!list)
+            return i;
+        if (chunk.parent >= 0 && chunks[chunk.parent].list &&
+            !memcmp(chunks[chunk.parent].id, list, 4))
+            return i;
+    }
+    return -1;
+}
+
+//---------------------------------------------------------
+//   children
+//    Chunks directly inside the form or LIST idx
+//---------------------------------------------------------
+
+std::vector<int> RiffIndex::children(int idx) const {
+    std::vector<int> result;
+    for (int i = idx + 1; i < (int)chunks.size(); ++i) {
+        if (chunks[i].parent == idx)
+            result.push_back(i);
+    }
+    return result;
+}
+
+//---------------------------------------------------------
+//   seek
+//    Position f at the data of the chunk found by find()
+//---------------------------------------------------------
+
+bool RiffIndex::seek(std::istream *f, const char *id, const char *list) const {
+    int idx = find(id, list);
+    if (idx < 0)
+        return false;
+    f->clear();
+    f->seekg(chunks[idx].offset);
+    return !f->fail();
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+#include <istream>
+#include <vector>
+
+//---------------------------------------------------------
+//   RiffChunk
+//    offset and length are those of the chunk data. For the
+//    RIFF form and LIST chunks, id is the form or list type
+//    and the data starts after it.
+//---------------------------------------------------------
+
+struct RiffChunk {
+    char id[4];
+    bool list;
+    uint64_t offset;
+    uint32_t length;
+    int parent; // index of the enclosing form or LIST, -1 for the form
+};
+
+//---------------------------------------------------------
+//   RiffIndex
+//    Table of contents of a RIFF file, built in one pass over
+//    the chunk headers without reading any chunk data. Chunks
+//    are listed in file order, every LIST before its
+//    contents.
+//---------------------------------------------------------
+
+class RiffIndex {
+    std::vector<RiffChunk> chunks;
+
+    void scan(std::istream *f, uint64_t pos, uint64_t end, int parent);
+
+  public:
+    void build(std::istream *f);
+    int size() const { return chunks.size(); }
+    const RiffChunk &operator[](int idx) const { return chunks[idx]; }
+    int find(const char *id, const char *list = nullptr) const;
+    std::vector<int> children(int idx) const;
+    bool seek(std::istream *f, const char *id, const char *list = nullptr) const;
+};
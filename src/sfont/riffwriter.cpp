@@ -0,0 +1,93 @@
+#include "riffwriter.h"
+
+#include <string>
+
+//---------------------------------------------------------
+//   RiffWriter
+//---------------------------------------------------------
+
+RiffWriter::RiffWriter(std::ostream *o) : out(o) { buffer.reserve(bufferSize); }
+
+//---------------------------------------------------------
+//   writeThrough
+//    Called when p does not fit in the buffer: flush, then
+//    buffer p or pass it straight on if it is large itself
+//---------------------------------------------------------
+
+void RiffWriter::writeThrough(const char *p, size_t n) {
+    flush();
+    if (n >= bufferSize) {
+        if (out->write(p, n).fail())
+            throw(std::string("write error"));
+        flushed += n;
+    } else
+        buffer.insert(buffer.end(), p, p + n);
+}
+
+//---------------------------------------------------------
+//   beginChunk
+//    Write the chunk header with a zero length. Returns the
+//    position of the length field for endChunk.
+//---------------------------------------------------------
+
+size_t RiffWriter::beginChunk(const char *fourcc) {
+    write(fourcc, 4);
+    size_t lenPos = pos();
+    writeDword(0);
+    return lenPos;
+}
+
+//---------------------------------------------------------
+//   endChunk
+//    Patch the length, which does not count the pad byte
+//---------------------------------------------------------
+
+void RiffWriter::endChunk(size_t lenPos) {
+    size_t len = pos() - lenPos - 4;
+    patchDword(lenPos, len);
+    pad(len);
+}
+
+//---------------------------------------------------------
+//   patchDword
+//---------------------------------------------------------
+
+void RiffWriter::patchDword(size_t pos, unsigned val) {
+    if (pos >= flushed)
+        memcpy(buffer.data() + (pos - flushed), &val, 4);
+    else
+        patches.push_back({pos, val});
+}
+
+//---------------------------------------------------------
+//   flush
+//---------------------------------------------------------
+
+void RiffWriter::flush() {
+    if (buffer.empty())
+        return;
+    if (out->write(buffer.data(), buffer.size()).fail())
+        throw(std::string("write error"));
+    flushed += buffer.size();
+    buffer.clear();
+}
+
+//---------------------------------------------------------
+//   close
+//    Flush and apply the patches to headers that had to be
+//    written before their length was known
+//---------------------------------------------------------
+
+void RiffWriter::close() {
+    flush();
+    if (patches.empty())
+        return;
+    for (const Patch &p : patches) {
+        out->seekp(p.pos);
+        if (out->write((const char *)&p.value, 4).fail())
+            throw(std::string("write error"));
+    }
+    patches.clear();
+    out->seekp(flushed);
+    out->flush();
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <cstddef>
+#include <cstring>
+#include <ostream>
+#include <vector>
+
+//---------------------------------------------------------
+//   RiffWriter
+//    Assembles the output in a memory buffer and hands it to
+//    the stream in large writes. Chunk lengths are patched
+//    in the buffer; only a header that was already flushed,
+//    because a chunk outgrew the buffer, is patched on the
+//    stream when the writer is closed. Chunks of odd length
+//    are followed by a zero pad byte, as RIFF requires.
+//---------------------------------------------------------
+
+class RiffWriter {
+    struct Patch {
+        size_t pos;
+        unsigned value;
+    };
+
+    std::ostream *out;
+    std::vector<char> buffer;
+    size_t flushed{0}; // bytes already written to out
+    std::vector<Patch> patches;
+
+    void writeThrough(const char *p, size_t n);
+
+  public:
+    static const size_t bufferSize = 4 * 1024 * 1024;
+
+    RiffWriter(std::ostream *o);
+    size_t pos() const { return flushed + buffer.size(); }
+
+    void write(const char *p, size_t n) {
+        if (buffer.size() + n > bufferSize)
+            writeThrough(p, n);
+        else
+            buffer.insert(buffer.end(), p, p + n);
+    }
+    void writeDword(unsigned val) { write((const char *)&val, 4); }
+    void writeWord(unsigned short val) { write((const char *)&val, 2); }
+
+    // Header of a chunk whose length is known up front. The
+    // caller writes the data and then pad(len).
+    void writeHeader(const char *fourcc, unsigned len) {
+        write(fourcc, 4);
+        writeDword(len);
+    }
+    void pad(size_t len) {
+        if (len & 1)
+            write("", 1);
+    }
+    static size_t padded(size_t len) { return len + (len & 1); }
+    size_t beginChunk(const char *fourcc);
+    void endChunk(size_t lenPos);
+    void patchDword(size_t pos, unsigned val);
+    void flush();
+    void close();
+};
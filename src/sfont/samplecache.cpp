@@ -0,0 +1,215 @@
+#include "samplecache.h"
+#include "hash.h"
+#include "oggdecoder.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+// Bump when the encoder output for the same settings changes
+static const uint64_t cacheVersion = 3;
+
+//---------------------------------------------------------
+//   SampleCache
+//---------------------------------------------------------
+
+SampleCache::SampleCache(const std::string &d, uint64_t max) : dir(d), maxBytes(max) {}
+
+//---------------------------------------------------------
+//   open
+//---------------------------------------------------------
+
+bool SampleCache::open() {
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    if (!fs::is_directory(dir)) {
+        fprintf(stderr, "cannot open sample cache <%s>\n", dir.string().c_str());
+        return false;
+    }
+    return true;
+}
+
+//---------------------------------------------------------
+//   key
+//    128 bit hex key over the PCM of both channels and the
+//    settings that change the encoded stream
+//---------------------------------------------------------
+
+std::string SampleCache::key(std::span<const int16_t> left, std::span<const int16_t> right,
+                             unsigned samplerate, double quality, double amp) {
+    struct {
+        uint64_t pcm[4];
+        uint64_t frames;
+        uint64_t channels;
+        uint64_t samplerate;
+        double quality;
+        double amp;
+        uint64_t version;
+    } fields;
+    fields.pcm[0] = hash64(left.data(), left.size_bytes(), 0);
+    fields.pcm[1] = hash64(left.data(), left.size_bytes(), 1);
+    fields.pcm[2] = hash64(right.data(), right.size_bytes(), 0);
+    fields.pcm[3] = hash64(right.data(), right.size_bytes(), 1);
+    fields.frames = left.size();
+    fields.channels = right.empty() ? 1 : 2;
+    fields.samplerate = samplerate;
+    fields.quality = quality;
+    fields.amp = amp;
+    fields.version = cacheVersion;
+
+    char buf[33];
+    snprintf(buf, sizeof(buf), "%016llx%016llx",
+             (unsigned long long)hash64(&fields, sizeof(fields), 0),
+             (unsigned long long)hash64(&fields, sizeof(fields), 1));
+    return buf;
+}
+
+//---------------------------------------------------------
+//   entryPath
+//    Entries are spread over 256 sub directories
+//---------------------------------------------------------
+
+fs::path SampleCache::entryPath(const std::string &key) const {
+    return dir / key.substr(0, 2) / (key + ".ogg");
+}
+
+//---------------------------------------------------------
+//   load
+//    On a hit, copy the stored stream to sink. An entry that
+//    is not one whole Ogg stream, left by a crash or a full
+//    disk, is removed and counts as a miss.
+//---------------------------------------------------------
+
+bool SampleCache::load(const std::string &key, OggSink &sink) {
+    fs::path path = entryPath(key);
+    std::ifstream f(path, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!f.is_open()) {
+        ++misses;
+        return false;
+    }
+    std::vector<char> data(f.tellg());
+    f.seekg(0);
+    if (data.empty() || f.read(data.data(), data.size()).fail()) {
+        ++misses;
+        return false;
+    }
+    f.close();
+    std::error_code ec;
+    if (!isCompleteOgg(data)) {
+        fs::remove(path, ec);
+        ++misses;
+        return false;
+    }
+    sink.write(data.data(), data.size());
+    fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+    ++hits;
+    hitBytes += data.size();
+    return true;
+}
+
+//---------------------------------------------------------
+//   tmpName
+//    The process id and a random token, seeded once per
+//    thread
+//---------------------------------------------------------
+
+static std::string tmpName() {
+#ifdef _WIN32
+    long pid = _getpid();
+#else
+    long pid = getpid();
+#endif
+    thread_local std::mt19937_64 rng(std::random_device{}());
+    char name[48];
+    snprintf(name, sizeof(name), ".%ld.%016llx.tmp", pid, (unsigned long long)rng());
+    return name;
+}
+
+//---------------------------------------------------------
+//   store
+//    Write to a temporary file and rename it into place, so
+//    concurrent readers never see a partial entry. The
+//    temporary name is unique to the process and the call,
+//    as other processes may share the cache. Failures only
+//    cost a later cache miss and are not reported.
+//---------------------------------------------------------
+
+void SampleCache::store(const std::string &key, const OggChunks &data) {
+    fs::path path = entryPath(key);
+    std::error_code ec;
+    fs::create_directories(path.parent_path(), ec);
+    fs::path tmp = path;
+    tmp += tmpName();
+    {
+        std::ofstream f(tmp, std::ios::out | std::ios::binary | std::ios::trunc);
+        for (const std::vector<char> &chunk : data)
+            f.write(chunk.data(), chunk.size());
+        if (!f) {
+            f.close();
+            fs::remove(tmp, ec);
+            return;
+        }
+    }
+    fs::rename(tmp, path, ec);
+    if (ec)
+        fs::remove(tmp, ec);
+}
+
+//---------------------------------------------------------
+//   trim
+//    Evict least recently used entries until the cache fits
+//    its size cap
+//---------------------------------------------------------
+
+void SampleCache::trim() {
+    struct Entry {
+        fs::file_time_type time;
+        uint64_t size;
+        fs::path path;
+    };
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it(dir, ec), end; it != end; it.increment(ec)) {
+        if (ec)
+            break;
+        if (!it->is_regular_file() || it->path().extension() != ".ogg")
+            continue;
+        Entry e{it->last_write_time(ec), it->file_size(ec), it->path()};
+        total += e.size;
+        entries.push_back(std::move(e));
+    }
+    if (total <= maxBytes)
+        return;
+    std::sort(entries.begin(), entries.end(),
+              [](const Entry &a, const Entry &b) { return a.time < b.time; });
+    for (const Entry &e : entries) {
+        if (total <= maxBytes)
+            break;
+        if (fs::remove(e.path, ec)) {
+            total -= e.size;
+            ++evicted;
+        }
+    }
+}
+
+//---------------------------------------------------------
+//   report
+//---------------------------------------------------------
+
+void SampleCache::report() const {
+    int lookups = hits + misses;
+    printf("Sample cache: %d hits, %d misses (%.1f%% hit rate), %.1f MB reused, %d evicted\n",
+           (int)hits, (int)misses, lookups ? 100.0 * hits / lookups : 0.0, hitBytes / 1048576.0,
+           evicted);
+}
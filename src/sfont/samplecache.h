@@ -0,0 +1,41 @@
+#pragma once
+#include "oggsink.h"
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <string>
+
+//---------------------------------------------------------
+//   SampleCache
+//    On-disk store of compressed samples, keyed by a hash of
+//    the PCM and the encoder settings. Entries are files named
+//    after their key; a hit refreshes the file time, and
+//    trim() evicts the least recently used entries once the
+//    cache grows past its size cap. Safe to use from several
+//    encoder threads and processes.
+//---------------------------------------------------------
+
+class SampleCache {
+    std::filesystem::path dir;
+    uint64_t maxBytes;
+
+    std::atomic<int> hits{0};
+    std::atomic<int> misses{0};
+    std::atomic<uint64_t> hitBytes{0};
+    int evicted{0};
+
+    std::filesystem::path entryPath(const std::string &key) const;
+
+  public:
+    SampleCache(const std::string &dir, uint64_t maxBytes);
+
+    bool open();
+    static std::string key(std::span<const int16_t> left, std::span<const int16_t> right,
+                           unsigned samplerate, double quality, double amp);
+    bool load(const std::string &key, OggSink &sink);
+    void store(const std::string &key, const OggChunks &data);
+    void trim();
+    void report() const;
+};
@@ -0,0 +1,183 @@
+#include "sampledata.h"
+
+#include <fstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+//---------------------------------------------------------
+//   SampleData
+//---------------------------------------------------------
+
+SampleData::~SampleData() { close(); }
+
+//---------------------------------------------------------
+//   open
+//    offset and len locate the smpl chunk body in bytes
+//---------------------------------------------------------
+
+bool SampleData::open(const std::string &path, size_t offset, size_t len) {
+    close();
+    if (!map(path, offset, len) && !load(path, offset, len))
+        return false;
+    frames = len / sizeof(int16_t);
+    length = len;
+    return true;
+}
+
+//---------------------------------------------------------
+//   close
+//---------------------------------------------------------
+
+void SampleData::close() {
+#ifdef _WIN32
+    if (mapping)
+        UnmapViewOfFile(mapping);
+    if (mappingHandle)
+        CloseHandle(mappingHandle);
+    if (fileHandle)
+        CloseHandle(fileHandle);
+    fileHandle = nullptr;
+    mappingHandle = nullptr;
+#else
+    if (mapping)
+        munmap(mapping, mappingLen);
+#endif
+    mapping = nullptr;
+    mappingLen = 0;
+    std::vector<int16_t>().swap(buffer);
+    data = nullptr;
+    frames = 0;
+    length = 0;
+}
+
+//---------------------------------------------------------
+//   map
+//    Mappings must start on a page (or allocation granularity)
+//    boundary, so map from the boundary below offset and skip
+//    the difference.
+//---------------------------------------------------------
+
+#ifdef _WIN32
+bool SampleData::map(const std::string &path, size_t offset, size_t len) {
+    if (len == 0)
+        return false;
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    HANDLE fileMapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!fileMapping) {
+        CloseHandle(file);
+        return false;
+    }
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    size_t base = offset - offset % info.dwAllocationGranularity;
+    size_t delta = offset - base;
+    unsigned long long base64 = base;
+    void *view = MapViewOfFile(fileMapping, FILE_MAP_READ, (DWORD)(base64 >> 32), (DWORD)base64,
+                               delta + len);
+    if (!view) {
+        CloseHandle(fileMapping);
+        CloseHandle(file);
+        return false;
+    }
+    fileHandle = file;
+    mappingHandle = fileMapping;
+    mapping = view;
+    mappingLen = delta + len;
+    data = reinterpret_cast<const int16_t *>(static_cast<const char *>(view) + delta);
+    return true;
+}
+#else
+bool SampleData::map(const std::string &path, size_t offset, size_t len) {
+    if (len == 0)
+        return false;
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t base = offset - offset % page;
+    size_t delta = offset - base;
+    void *view = mmap(nullptr, delta + len, PROT_READ, MAP_PRIVATE, fd, base);
+    ::close(fd); // the mapping keeps its own reference to the file
+    if (view == MAP_FAILED)
+        return false;
+    mapping = view;
+    mappingLen = delta + len;
+    data = reinterpret_cast<const int16_t *>(static_cast<const char *>(view) + delta);
+    return true;
+}
+#endif
+
+//---------------------------------------------------------
+//   load
+//    Fallback: read the whole chunk with one bulk read
+//---------------------------------------------------------
+
+bool SampleData::load(const std::string &path, size_t offset, size_t len) {
+    std::ifstream f(path, std::ios::in | std::ios::binary);
+    if (!f.is_open())
+        return false;
+    buffer.resize((len + 1) / sizeof(int16_t));
+    f.seekg(offset);
+    if (f.read(reinterpret_cast<char *>(buffer.data()), len).fail()) {
+        std::vector<int16_t>().swap(buffer);
+        return false;
+    }
+    data = buffer.data();
+    return true;
+}
+
+//---------------------------------------------------------
+//   view
+//    Frames [start, end) of the chunk
+//---------------------------------------------------------
+
+std::span<const int16_t> SampleData::view(size_t start, size_t end) const {
+    if (start > end || end > frames)
+        throw(std::string("sample data out of range"));
+    return std::span<const int16_t>(data + start, end - start);
+}
+
+//---------------------------------------------------------
+//   bytes
+//    Bytes [start, end) of the chunk
+//---------------------------------------------------------
+
+std::span<const char> SampleData::bytes(size_t start, size_t end) const {
+    if (start > end || end > length)
+        throw(std::string("sample data out of range"));
+    return std::span<const char>(reinterpret_cast<const char *>(data) + start, end - start);
+}
+
+//---------------------------------------------------------
+//   release
+//    Drop the mapped pages wholly inside frames [start, end)
+//    from memory. They are read from the file again if used
+//    later. Does nothing for data that was loaded instead.
+//---------------------------------------------------------
+
+void SampleData::release(size_t start, size_t end) {
+#ifndef _WIN32
+    if (!mapping || start >= end || end > frames)
+        return;
+    static const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+    uintptr_t first = reinterpret_cast<uintptr_t>(data + start);
+    uintptr_t last = reinterpret_cast<uintptr_t>(data + end);
+    first = (first + pageSize - 1) & ~(pageSize - 1);
+    last &= ~(pageSize - 1);
+    if (first < last)
+        madvise(reinterpret_cast<void *>(first), last - first, MADV_DONTNEED);
+#else
+    (void)start;
+    (void)end;
+#endif
+}
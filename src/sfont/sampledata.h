@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+//---------------------------------------------------------
+//   SampleData
+//    Read-only view of the 16 bit PCM in a SoundFont smpl
+//    chunk. The chunk is memory mapped once, falling back to
+//    a single bulk read where mapping is not available, and
+//    every sample is handed out as a zero-copy span. The
+//    chunk of a compressed font is read as bytes.
+//---------------------------------------------------------
+
+class SampleData {
+    const int16_t *data{nullptr};
+    size_t frames{0};
+    size_t length{0}; // bytes
+
+    void *mapping{nullptr};
+    size_t mappingLen{0};
+#ifdef _WIN32
+    void *fileHandle{nullptr};
+    void *mappingHandle{nullptr};
+#endif
+    std::vector<int16_t> buffer;
+
+    bool map(const std::string &path, size_t offset, size_t len);
+    bool load(const std::string &path, size_t offset, size_t len);
+
+  public:
+    SampleData() = default;
+    SampleData(const SampleData &) = delete;
+    SampleData &operator=(const SampleData &) = delete;
+    ~SampleData();
+
+    bool open(const std::string &path, size_t offset, size_t len);
+    void close();
+    bool isOpen() const { return data != nullptr; }
+    size_t size() const { return frames; }
+    std::span<const int16_t> view(size_t start, size_t end) const;
+    std::span<const char> bytes(size_t start, size_t end) const;
+    void release(size_t start, size_t end);
+};
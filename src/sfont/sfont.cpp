@@ -1,33 +1,30 @@
 #include "sfont.h"
+#include "hash.h"
+#include "oggdecoder.h"
+#include "outputfile.h"
+#include "parallel.h"
+#include "pcmconvert.h"
+#include "previousfont.h"
+#include "samplecache.h"
+#include "stats.h"
 
 #include <vorbis/vorbisenc.h>
 
+#include <array>
 #include <bit>
+#include <chrono>
+#include <condition_variable>
 #include <cstring>
+#include <map>
+#include <mutex>
+#include <sstream>
 #include <math.h>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <unordered_map>
 
 #define FOURCC(a, b, c, d) a << 24 | b << 16 | c << 8 | d
-#define BLOCK_SIZE 1024
-
-static const bool writeCompressed = true;
-
-//---------------------------------------------------------
-//   Sample
-//---------------------------------------------------------
-
-Sample::Sample() { name = 0; }
-
-Sample::~Sample() { free(name); }
-
-//---------------------------------------------------------
-//   Instrument
-//---------------------------------------------------------
-
-Instrument::Instrument() { name = 0; }
-
-Instrument::~Instrument() { free(name); }
 
 //---------------------------------------------------------
 //   SoundFont
@@ -58,15 +55,11 @@ SoundFont::~SoundFont() {
 
 //---------------------------------------------------------
 //   read
+//    Index the chunks, then parse those of the INFO, sdta
+//    and pdta lists. Unknown INFO sub-chunks are kept and
+//    written out again, other unknown chunks are skipped.
 //---------------------------------------------------------
 
-void compareFourcc(char *original, const char *expected) {
-    const auto originalFourcc = FOURCC(original[0], original[1], original[2], original[3]);
-    const auto expectedFourcc = FOURCC(expected[0], expected[1], expected[2], expected[3]);
-    if (originalFourcc != expectedFourcc)
-        throw fprintf(stderr, "Invalid fourcc: <%s>, expected <%s>\n", original, expected);
-}
-
 bool SoundFont::read() {
     file = new std::fstream(path, std::ios::in | std::ios::binary);
     if (!file->is_open()) {
@@ -75,30 +68,34 @@ bool SoundFont::read() {
         return false;
     }
     try {
+        PhaseTimer readTimer(stats, "read");
         printf("Header chunk <RIFF>\n");
-        char fourcc[4];
-        int len = readFourcc(fourcc);
-        compareFourcc(fourcc, "RIFF");
-        readSignature(fourcc);
-        compareFourcc(fourcc, "sfbk");
-        len -= 4;
-        unsigned long posg = 12;
-        file->seekg(posg);
-        while (len) {
+        riff.build(file);
+        if (memcmp(riff[0].id, "sfbk", 4))
+            throw(std::string("not a SoundFont"));
+        for (int list : riff.children(0)) {
+            const RiffChunk &top = riff[list];
+            if (!top.list) {
+                printf("skipping chunk <%.4s>\n", top.id);
+                continue;
+            }
             printf("Top chunk <LIST>\n");
-            int len2 = readFourcc(fourcc);
-            compareFourcc(fourcc, "LIST");
-            readSignature(fourcc);
-            posg += 12;
-            file->seekg(posg);
-            len -= (len2 + 8);
-            len2 -= 4;
-            while (len2) {
-                int len3 = readFourcc(fourcc);
-                len2 -= (len3 + 8);
-                readSection(fourcc, len3);
-                posg += 8 + len3;
-                file->seekg(posg);
+            PhaseTimer listTimer(stats, "read " + std::string(top.id, 4));
+            bool info = !memcmp(top.id, "INFO", 4);
+            for (int idx : riff.children(list)) {
+                const RiffChunk &chunk = riff[idx];
+                printf("readSection <%.4s> len %u\n", chunk.id, chunk.length);
+                file->clear();
+                file->seekg(chunk.offset);
+                if (chunk.list || !readSection(chunk.id, chunk.length)) {
+                    if (info && !chunk.list) {
+                        RawChunk raw;
+                        memcpy(raw.id, chunk.id, 4);
+                        raw.data = readChunk(chunk.length);
+                        infoChunks.push_back(std::move(raw));
+                    } else
+                        printf("skipping chunk <%.4s> in <%.4s>\n", chunk.id, top.id);
+                }
             }
         }
     } catch (std::string s) {
@@ -111,54 +108,57 @@ bool SoundFont::read() {
 }
 
 //---------------------------------------------------------
-//   skip
-//---------------------------------------------------------
-
-void SoundFont::skip(int n) {
-    int pos = file->tellg();
-    if (!file->seekg(pos + n))
-        throw(std::string("unexpected end of file\n"));
-}
-
-//---------------------------------------------------------
-//   readFourcc
-//---------------------------------------------------------
-
-int SoundFont::readFourcc(char *signature) {
-    readSignature(signature);
-    return readDword();
-}
-
-int SoundFont::readFourcc(const char *signature) {
-    readSignature(signature);
-    return readDword();
-}
-
-//---------------------------------------------------------
-//   readSignature
+//   readMetadata
+//    Fast open for listing presets: from the chunk index
+//    only pdta/phdr is read, and with info the INFO list.
+//    Everything else, the sample data included, is skipped
+//    and nothing is printed. A font opened this way cannot
+//    be written.
 //---------------------------------------------------------
 
-void SoundFont::readSignature(const char *signature) {
-    char fourcc[4];
-    readSignature(fourcc);
-    if (memcmp(fourcc, signature, 4) != 0)
-        throw std::runtime_error("fourcc " + std::string(signature) + " expected");
-}
-
-void SoundFont::readSignature(char *signature) {
-    if (file->read(signature, 4).fail())
-        throw(std::string("unexpected end of file\n"));
+static bool isInfoSection(const char *fourcc) {
+    static const char *sections[] = {"ifil", "INAM", "isng", "IPRD", "IENG",
+                                     "ISFT", "ICRD", "ICMT", "ICOP"};
+    for (const char *section : sections) {
+        if (!memcmp(fourcc, section, 4))
+            return true;
+    }
+    return false;
 }
 
-//---------------------------------------------------------
-//   readDword
-//---------------------------------------------------------
-
-unsigned SoundFont::readDword() {
-    unsigned format;
-    if (file->read((char *)&format, 4).fail())
-        throw(std::string("unexpected end of file\n"));
-    return format;
+bool SoundFont::readMetadata(bool info) {
+    file = new std::fstream(path, std::ios::in | std::ios::binary);
+    if (!file->is_open()) {
+        fprintf(stderr, "cannot open <%s>\n", path.c_str());
+        delete file;
+        return false;
+    }
+    try {
+        riff.build(file);
+        if (memcmp(riff[0].id, "sfbk", 4))
+            throw(std::string("not a SoundFont"));
+        int infoList = info ? riff.find("INFO") : -1;
+        if (infoList >= 0 && riff[infoList].list) {
+            for (int idx : riff.children(infoList)) {
+                const RiffChunk &chunk = riff[idx];
+                if (chunk.list || !isInfoSection(chunk.id))
+                    continue;
+                file->seekg(chunk.offset);
+                readSection(chunk.id, chunk.length);
+            }
+        }
+        int phdr = riff.find("phdr", "pdta");
+        if (phdr < 0)
+            throw(std::string("no preset headers"));
+        file->seekg(riff[phdr].offset);
+        readPhdr(readChunk(riff[phdr].length));
+    } catch (std::string s) {
+        fprintf(stderr, "read sf file failed: %s\n", s.c_str());
+        delete file;
+        return false;
+    }
+    delete file;
+    return true;
 }
 
 //---------------------------------------------------------
@@ -192,81 +192,68 @@ void SoundFont::writeChar(char val) { write((char *)&val, 1); }
 void SoundFont::writeShort(short val) { write((char *)&val, 2); }
 
 //---------------------------------------------------------
-//   readWord
+//   readVersion
 //---------------------------------------------------------
 
-int SoundFont::readWord() {
-    unsigned short format;
-    if (file->read((char *)&format, 2).fail())
+void SoundFont::readVersion() {
+    unsigned char data[4];
+    if (file->read((char *)data, 4).fail())
         throw(std::string("unexpected end of file\n"));
-    return format;
+    version.major = data[0] + (data[1] << 8);
+    version.minor = data[2] + (data[3] << 8);
 }
 
 //---------------------------------------------------------
-//   readShort
+//   readChunk
+//    Read a whole chunk body with one bulk read
 //---------------------------------------------------------
 
-int SoundFont::readShort() {
-    short format;
-    if (file->read((char *)&format, 2).fail())
+std::vector<unsigned char> SoundFont::readChunk(uint32_t len) {
+    std::vector<unsigned char> data(len);
+    if (len && file->read((char *)data.data(), len).fail())
         throw(std::string("unexpected end of file\n"));
-    return format;
+    return data;
 }
 
 //---------------------------------------------------------
-//   readByte
+//   little endian field decoders
 //---------------------------------------------------------
 
-int SoundFont::readByte() {
-    unsigned char val;
-    if (file->read((char *)&val, 1).fail())
-        throw(std::string("unexpected end of file\n"));
-    return val;
-}
+static inline int decodeWord(const unsigned char *p) { return p[0] | (p[1] << 8); }
 
-//---------------------------------------------------------
-//   readChar
-//---------------------------------------------------------
+static inline int decodeShort(const unsigned char *p) { return (short)(p[0] | (p[1] << 8)); }
 
-int SoundFont::readChar() {
-    char val;
-    if (file->read(&val, 1).fail())
-        throw(std::string("unexpected end of file\n"));
-    return val;
+static inline unsigned decodeDword(const unsigned char *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
 }
 
-//---------------------------------------------------------
-//   readVersion
-//---------------------------------------------------------
+static char *decodeString(const unsigned char *p, size_t n) {
+    size_t len = strnlen((const char *)p, n);
+    char *s = (char *)malloc(len + 1);
+    memcpy(s, p, len);
+    s[len] = 0;
+    return s;
+}
 
-void SoundFont::readVersion() {
-    unsigned char data[4];
-    if (file->read((char *)data, 4).fail())
-        throw(std::string("unexpected end of file\n"));
-    version.major = data[0] + (data[1] << 8);
-    version.minor = data[2] + (data[3] << 8);
+static void decodeName(const unsigned char *p, char (&name)[21]) {
+    int len = strnlen((const char *)p, 20);
+    memcpy(name, p, len);
+    name[len] = 0;
 }
 
 //---------------------------------------------------------
 //   readString
 //---------------------------------------------------------
 
-char *SoundFont::readString(int n) {
-    char data[2500];
-    if (file->read((char *)data, n).fail())
-        throw(std::string("unexpected end of file\n"));
-    if (data[n - 1] != 0)
-        data[n] = 0;
-    return strdup(data);
-}
+char *SoundFont::readString(uint32_t n) { return decodeString(readChunk(n).data(), n); }
 
 //---------------------------------------------------------
 //   readSection
+//    Parse the chunk at the file position. Returns false for
+//    chunks not interpreted here.
 //---------------------------------------------------------
 
-void SoundFont::readSection(const char *fourcc, int len) {
-    printf("readSection <%c%c%c%c> len %d\n", fourcc[0], fourcc[1], fourcc[2], fourcc[3], len);
-
+bool SoundFont::readSection(const char *fourcc, uint32_t len) {
     switch (FOURCC(fourcc[0], fourcc[1], fourcc[2], fourcc[3])) {
     case FOURCC('i', 'f', 'i', 'l'): // version
         readVersion();
@@ -299,49 +286,48 @@ void SoundFont::readSection(const char *fourcc, int len) {
     case FOURCC('s', 'm', 'p', 'l'): // the digital audio samples
         samplePos = file->tellg();
         sampleLen = len;
-        skip(len);
         break;
     case FOURCC('p', 'h', 'd', 'r'): // preset headers
-        readPhdr(len);
+        readPhdr(readChunk(len));
         break;
     case FOURCC('p', 'b', 'a', 'g'): // preset index list
-        readBag(len, &pZones);
+        readBag(readChunk(len), &pZones);
         break;
     case FOURCC('p', 'm', 'o', 'd'): // preset modulator list
-        readMod(len, &pZones);
+        readMod(readChunk(len), &pZones);
         break;
     case FOURCC('p', 'g', 'e', 'n'): // preset generator list
-        readGen(len, &pZones);
+        readGen(readChunk(len), &pZones);
         break;
     case FOURCC('i', 'n', 's', 't'): // instrument names and indices
-        readInst(len);
+        readInst(readChunk(len));
         break;
     case FOURCC('i', 'b', 'a', 'g'): // instrument index list
-        readBag(len, &iZones);
+        readBag(readChunk(len), &iZones);
         break;
     case FOURCC('i', 'm', 'o', 'd'): // instrument modulator list
-        readMod(len, &iZones);
+        readMod(readChunk(len), &iZones);
         break;
     case FOURCC('i', 'g', 'e', 'n'): // instrument generator list
-        readGen(len, &iZones);
+        readGen(readChunk(len), &iZones);
         break;
     case FOURCC('s', 'h', 'd', 'r'): // sample headers
-        readShdr(len);
-        break;
-    case FOURCC('i', 'r', 'o', 'm'): // sample rom
-    case FOURCC('i', 'v', 'e', 'r'): // sample rom version
-    default:
-        skip(len);
-        throw std::runtime_error("unknown fourcc " + std::string(fourcc));
+        readShdr(readChunk(len));
         break;
+    default: // irom, iver, sm24 and anything else
+        return false;
     }
+    return true;
 }
 
 //---------------------------------------------------------
 //   readPhdr
+//    38 byte records: name[20], preset, bank, bag index,
+//    library, genre, morphology
 //---------------------------------------------------------
 
-void SoundFont::readPhdr(int len) {
+void SoundFont::readPhdr(const std::vector<unsigned char> &data) {
+    int len = data.size();
     if (len < (38 * 2))
         throw(std::string("phdr too short"));
     if (len % 38)
@@ -349,170 +335,181 @@ void SoundFont::readPhdr(int len) {
     int n = len / 38;
     if (n <= 1) {
         printf("no presets\n");
-        skip(len);
         return;
     }
+    presets.resize(n);
     int index1 = 0, index2;
-    for (int i = 0; i < n; ++i) {
-        Preset *preset = new Preset;
-        preset->name = readString(20);
-        preset->preset = readWord();
-        preset->bank = readWord();
-        index2 = readWord();
-        preset->library = readDword();
-        preset->genre = readDword();
-        preset->morphology = readDword();
+    const unsigned char *p = data.data();
+    for (int i = 0; i < n; ++i, p += 38) {
+        Preset &preset = presets[i];
+        decodeName(p, preset.name);
+        preset.preset = decodeWord(p + 20);
+        preset.bank = decodeWord(p + 22);
+        index2 = decodeWord(p + 24);
+        preset.library = decodeDword(p + 26);
+        preset.genre = decodeDword(p + 30);
+        preset.morphology = decodeDword(p + 34);
         if (index2 < index1)
             throw("preset header indices not monotonic");
         if (i > 0) {
-            int n = index2 - index1;
-            while (n--) {
-                Zone *z = new Zone;
-                presets.back()->zones.push_back(z);
-                pZones.push_back(z);
-            }
+            presets[i - 1].zoneIndex = pZones.zones.size();
+            presets[i - 1].zoneCount = index2 - index1;
+            pZones.zones.resize(pZones.zones.size() + index2 - index1);
         }
         index1 = index2;
-        presets.push_back(preset);
     }
     presets.pop_back();
 }
 
 //---------------------------------------------------------
 //   readBag
+//    4 byte records: generator index, modulator index.
+//    Zone ranges are stored relative to the first record.
 //---------------------------------------------------------
 
-void SoundFont::readBag(int len, std::vector<Zone *> *zones) {
+void SoundFont::readBag(const std::vector<unsigned char> &data, ZoneList *zones) {
+    int len = data.size();
     if (len % 4)
         throw(std::string("bag size not a multiple of 4"));
+    if ((int)zones->zones.size() + 1 > len / 4)
+        throw(std::string("bag size too small"));
+    const unsigned char *p = data.data();
     int gIndex2, mIndex2;
-    int gIndex1 = readWord();
-    int mIndex1 = readWord();
-    len -= 4;
-    for (Zone *zone : *zones) {
-        gIndex2 = readWord();
-        mIndex2 = readWord();
-        len -= 4;
-        if (len < 0)
-            throw(std::string("bag size too small"));
+    int gIndex1 = decodeWord(p);
+    int mIndex1 = decodeWord(p + 2);
+    int gIndex = 0, mIndex = 0;
+    for (Zone &zone : zones->zones) {
+        p += 4;
+        gIndex2 = decodeWord(p);
+        mIndex2 = decodeWord(p + 2);
         if (gIndex2 < gIndex1)
             throw("generator indices not monotonic");
         if (mIndex2 < mIndex1)
             throw("modulator indices not monotonic");
-        int n = mIndex2 - mIndex1;
-        while (n--)
-            zone->modulators.push_back(new ModulatorList);
-        n = gIndex2 - gIndex1;
-        while (n--)
-            zone->generators.push_back(new GeneratorList);
+        zone.genIndex = gIndex;
+        zone.genCount = gIndex2 - gIndex1;
+        zone.modIndex = mIndex;
+        zone.modCount = mIndex2 - mIndex1;
+        gIndex += zone.genCount;
+        mIndex += zone.modCount;
         gIndex1 = gIndex2;
         mIndex1 = mIndex2;
     }
+    zones->generators.resize(gIndex);
+    zones->modulators.resize(mIndex);
 }
 
 //---------------------------------------------------------
 //   readMod
+//    10 byte records: source, destination, amount,
+//    amount source, transform
 //---------------------------------------------------------
 
-void SoundFont::readMod(int size, std::vector<Zone *> *zones) {
-    for (Zone *zone : *zones) {
-        for (ModulatorList *m : zone->modulators) {
-            size -= 10;
-            if (size < 0)
-                throw(std::string("pmod size mismatch"));
-            m->src = static_cast<Modulator>(readWord());
-            m->dst = static_cast<Generator>(readWord());
-            m->amount = readShort();
-            m->amtSrc = static_cast<Modulator>(readWord());
-            m->transform = static_cast<Transform>(readWord());
-        }
-    }
+void SoundFont::readMod(const std::vector<unsigned char> &data, ZoneList *zones) {
+    int size = data.size() - zones->modulators.size() * 10;
+    if (size < 0)
+        throw(std::string("pmod size mismatch"));
     if (size != 10)
         throw(std::string("modulator list size mismatch"));
-    skip(10);
+    const unsigned char *p = data.data();
+    for (ModulatorList &m : zones->modulators) {
+        m.src = static_cast<Modulator>(decodeWord(p));
+        m.dst = static_cast<Generator>(decodeWord(p + 2));
+        m.amount = decodeShort(p + 4);
+        m.amtSrc = static_cast<Modulator>(decodeWord(p + 6));
+        m.transform = static_cast<Transform>(decodeWord(p + 8));
+        p += 10;
+    }
 }
 
 //---------------------------------------------------------
 //   readGen
+//    4 byte records: generator, amount
 //---------------------------------------------------------
 
-void SoundFont::readGen(int size, std::vector<Zone *> *zones) {
+void SoundFont::readGen(const std::vector<unsigned char> &data, ZoneList *zones) {
+    int size = data.size();
     if (size % 4)
         throw(std::string("bad generator list size"));
-    for (Zone *zone : *zones) {
-        size -= (zone->generators.size() * 4);
-        if (size < 0)
-            break;
-
-        for (GeneratorList *gen : zone->generators) {
-            gen->gen = static_cast<Generator>(readWord());
-            if (gen->gen == Gen_KeyRange || gen->gen == Gen_VelRange) {
-                gen->amount.lo = readByte();
-                gen->amount.hi = readByte();
-            } else if (gen->gen == Gen_Instrument)
-                gen->amount.uword = readWord();
-            else
-                gen->amount.sword = readWord();
-        }
-    }
+    size -= zones->generators.size() * 4;
     if (size != 4)
         throw std::runtime_error("generator list size mismatch " + std::to_string(size) + " != 4");
-    skip(size);
+    const unsigned char *p = data.data();
+    for (GeneratorList &gen : zones->generators) {
+        gen.gen = static_cast<Generator>(decodeWord(p));
+        if (gen.gen == Gen_KeyRange || gen.gen == Gen_VelRange) {
+            gen.amount.lo = p[2];
+            gen.amount.hi = p[3];
+        } else if (gen.gen == Gen_Instrument)
+            gen.amount.uword = decodeWord(p + 2);
+        else
+            gen.amount.sword = decodeShort(p + 2);
+        p += 4;
+    }
 }
 
 //---------------------------------------------------------
 //   readInst
+//    22 byte records: name[20], bag index
 //---------------------------------------------------------
 
-void SoundFont::readInst(int size) {
-    int n = size / 22;
+void SoundFont::readInst(const std::vector<unsigned char> &data) {
+    int n = data.size() / 22;
+    if (n == 0)
+        return;
+    instruments.resize(n);
     int index1 = 0, index2;
-    for (int i = 0; i < n; ++i) {
-        Instrument *instrument = new Instrument;
-        instrument->name = readString(20);
-        index2 = readWord();
+    const unsigned char *p = data.data();
+    for (int i = 0; i < n; ++i, p += 22) {
+        Instrument &instrument = instruments[i];
+        decodeName(p, instrument.name);
+        index2 = decodeWord(p + 20);
         if (index2 < index1)
             throw("instrument header indices not monotonic");
         if (i > 0) {
-            int n = index2 - index1;
-            while (n--) {
-                Zone *z = new Zone;
-                instruments.back()->zones.push_back(z);
-                iZones.push_back(z);
-            }
+            instruments[i - 1].zoneIndex = iZones.zones.size();
+            instruments[i - 1].zoneCount = index2 - index1;
+            iZones.zones.resize(iZones.zones.size() + index2 - index1);
         }
         index1 = index2;
-        instruments.push_back(instrument);
     }
     instruments.pop_back();
 }
 
 //---------------------------------------------------------
 //   readShdr
+//    46 byte records: name[20], start, end, loop start,
+//    loop end, sample rate, original pitch, pitch
+//    correction, sample link, sample type
 //---------------------------------------------------------
 
-void SoundFont::readShdr(int size) {
-    int n = size / 46;
-    for (int i = 0; i < n - 1; ++i) {
-        Sample *s = new Sample;
-        s->name = readString(20);
-        s->start = readDword();
-        s->end = readDword();
-        s->loopstart = readDword();
-        s->loopend = readDword();
-        s->samplerate = readDword();
-        s->origpitch = readByte();
-        s->pitchadj = readChar();
-        readWord(); // sampleLink
-        s->sampletype = readWord();
-
-        s->loopstart -= s->start;
-        s->loopend -= s->start;
-        // printf("readFontHeader %d %d   %d %d\n", s->start, s->end, s->loopstart,
-        // s->loopend);
-        samples.push_back(s);
+void SoundFont::readShdr(const std::vector<unsigned char> &data) {
+    int n = data.size() / 46;
+    if (n == 0)
+        return;
+    samples.resize(n - 1); // skip the trailing record
+    const unsigned char *p = data.data();
+    for (Sample &s : samples) {
+        decodeName(p, s.name);
+        s.start = decodeDword(p + 20);
+        s.end = decodeDword(p + 24);
+        s.loopstart = decodeDword(p + 28);
+        s.loopend = decodeDword(p + 32);
+        s.samplerate = decodeDword(p + 36);
+        s.origpitch = p[40];
+        s.pitchadj = (signed char)p[41];
+        s.sampleLink = decodeWord(p + 42);
+        s.sampletype = decodeWord(p + 44);
+
+        // Loop points of compressed samples are already relative
+        if (version.major != 3 || !(s.sampletype & 0x10)) {
+            s.loopstart -= s.start;
+            s.loopend -= s.start;
+        }
+        // printf("readFontHeader %d %d   %d %d\n", s.start, s.end, s.loopstart,
+        // s.loopend);
+        p += 46;
     }
-    skip(46); // trailing record
 }
 
 static const char *generatorNames[] = {"StartAddrOfs",
@@ -576,99 +573,841 @@ static const char *generatorNames[] = {"StartAddrOfs",
                                        "OverrideRootKey",
                                        "Dummy"};
 
+//---------------------------------------------------------
+//   chunksSize
+//---------------------------------------------------------
+
+static size_t chunksSize(const OggChunks &chunks) {
+    size_t len = 0;
+    for (const std::vector<char> &chunk : chunks)
+        len += chunk.size();
+    return len;
+}
+
 //---------------------------------------------------------
 //   write
 //---------------------------------------------------------
 
-bool SoundFont::write(std::fstream *f, double oggQuality, double oggAmp) {
-    file = f;
-    _oggQuality = oggQuality;
-    _oggAmp = oggAmp;
-    int riffLenPos;
-    int listLenPos;
+bool SoundFont::write(std::ostream *f, const WriteOptions &o) {
+    if (!prepare(o))
+        return false;
+    // Output that cannot seek back to the lengths needs every sample
+    // encoded first, otherwise samples are encoded while writing
+    if (options.streaming) {
+        try {
+            PhaseTimer timer(stats, "encode");
+            parallelFor(streams.size(), options.jobs, [this](int i) {
+                encodeStream(i);
+                releasePcm(streams[i]);
+            });
+        } catch (std::string s) {
+            printf("write sf file failed: %s\n", s.c_str());
+            return false;
+        }
+    }
+    return writePrepared(f);
+}
+
+bool SoundFont::write(OutputFile *f, const WriteOptions &o) {
+    if (!prepare(o))
+        return false;
+    return writePrepared(f);
+}
+
+//---------------------------------------------------------
+//   prepare
+//    Map the sample data and lay out the ogg streams. Each
+//    stream holds a mono sample, or with joint stereo a left
+//    sample together with its linked right sample.
+//---------------------------------------------------------
+
+bool SoundFont::prepare(const WriteOptions &o) {
+    options = o;
+    if (options.jobs <= 0)
+        options.jobs = std::max(1u, std::thread::hardware_concurrency());
+    PhaseTimer timer(stats, "prepare");
+    if (!sampleData.isOpen() && !sampleData.open(path, samplePos, sampleLen)) {
+        fprintf(stderr, "cannot read sample data from <%s>\n", path.c_str());
+        return false;
+    }
+
+    if (options.prune)
+        prune();
+
+    streams.clear();
+    if (!writeCompressed)
+        return true;
+    // Right samples of joint stereo pairs go into the stream of their
+    // left sample, whichever of the two comes first
+    std::vector<int> partner(samples.size(), -1);
+    std::vector<bool> isRight(samples.size());
+    if (options.jointStereo) {
+        for (int i = 0; i < (int)samples.size(); ++i) {
+            partner[i] = stereoPartner(i);
+            if (partner[i] >= 0)
+                isRight[partner[i]] = true;
+        }
+    }
+    for (int i = 0; i < (int)samples.size(); ++i) {
+        if (isRight[i])
+            continue;
+        OggStream stream;
+        stream.sample = i;
+        stream.right = partner[i];
+        stream.quality = options.oggQuality;
+        streams.push_back(std::move(stream));
+    }
+
+    // Every stream's data is hashed once, for deduplication and its key
+    for (OggStream &stream : streams) {
+        stream.dataHash = streamHash(stream);
+        releasePcm(stream);
+    }
+    if (options.dedupe)
+        dedupeStreams();
+
+    if (options.targetSnr > 0 || options.targetSize > 0) {
+        try {
+            PhaseTimer timer(stats, "quality search");
+            searchQualities();
+        } catch (std::string s) {
+            printf("quality search failed: %s\n", s.c_str());
+            return false;
+        }
+    }
+
+    // Keys follow from what is encoded, so the output is the same on
+    // every run and an unchanged sample keeps its stream, see PreviousFont
+    for (OggStream &stream : streams)
+        stream.key = streamKey(stream, stream.quality);
+    return true;
+}
+
+//---------------------------------------------------------
+//   Quality search
+//    Trial encodes run on a grid of qualities, each is
+//    decoded again and compared with the source. Sizes and
+//    SNRs are memoized per stream, so the size search only
+//    encodes a stream at a quality once. Of the encoded data
+//    only a stream's current candidate and, in the size
+//    search, the best choice so far are kept; the one chosen
+//    becomes the stream data.
+//---------------------------------------------------------
+
+static const int qualitySteps = 11; // 0.0, 0.1 ... 1.0
+
+static double stepQuality(int step) { return step / double(qualitySteps - 1); }
+
+struct QualityTrial {
+    bool done{false};
+    size_t bytes{0};
+    double snr{0};     // dB
+    double seconds{0}; // encode time
+};
+
+struct KeptEncode {
+    int step{-1};
+    OggChunks data;
+};
+
+//---------------------------------------------------------
+//   trialEncode
+//    Size and signal to noise ratio of the stream encoded at
+//    the given quality. The encode uses the key the stream
+//    gets at that quality and is returned in data, so it can
+//    be kept as the stream data if the quality is chosen.
+//---------------------------------------------------------
+
+QualityTrial SoundFont::trialEncode(const OggStream &stream, double quality, OggChunks *data) {
+    const Sample *s = &samples[stream.sample];
+    const Sample *right = stream.right >= 0 ? &samples[stream.right] : nullptr;
+    auto start = std::chrono::steady_clock::now();
+    ChunkSink sink;
+    if (!compressSample(s, right, streamKey(stream, quality), quality, sink))
+        throw(std::string("vorbis init failed"));
+    std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+    QualityTrial trial;
+    trial.done = true;
+    trial.bytes = sink.size();
+    trial.seconds = time.count();
+    *data = sink.take();
+
+    std::vector<char> bytes;
+    bytes.reserve(trial.bytes);
+    for (const std::vector<char> &chunk : *data)
+        bytes.insert(bytes.end(), chunk.begin(), chunk.end());
+    DecodedStream decoded;
+    if (!decodeOgg(bytes, &decoded) || decoded.empty())
+        throw(std::string("cannot decode trial encode"));
+
+    double linearAmp = pow(10.0, options.oggAmp / 20.0);
+    double signal = 0;
+    double noise = 0;
+    for (size_t c = 0; c < decoded.size(); ++c) {
+        const Sample *source = c ? right : s;
+        std::span<const int16_t> pcm = sampleData.view(source->start, source->end);
+        size_t n = std::min(pcm.size(), decoded[c].size());
+        for (size_t i = 0; i < n; ++i) {
+            double v = std::clamp(pcm[i] * linearAmp, -32768.0, 32767.0);
+            double e = v - decoded[c][i];
+            signal += v * v;
+            noise += e * e;
+        }
+        // Frames the decoder dropped count as error
+        for (size_t i = n; i < pcm.size(); ++i) {
+            double v = pcm[i] * linearAmp;
+            signal += v * v;
+            noise += v * v;
+        }
+    }
+    trial.snr = noise > 0 ? 10 * log10(signal / noise) : 200;
+    return trial;
+}
+
+//---------------------------------------------------------
+//   searchQualities
+//    Give every stream the lowest quality that meets the
+//    target: at least options.targetSnr, or the highest SNR
+//    every stream can meet while the font stays within
+//    options.targetSize bytes. With options.maxMemory no
+//    encode is kept, the streams are encoded again within
+//    the budget when written.
+//---------------------------------------------------------
+
+void SoundFont::searchQualities() {
+    std::vector<std::array<QualityTrial, qualitySteps>> trials(streams.size());
+    std::vector<KeptEncode> current(streams.size()); // encode at the step chosen last
+    std::vector<KeptEncode> best(streams.size());    // encode at the best steps so far
+    bool keep = !options.maxMemory;
+    auto trial = [&](int idx, int step, OggChunks *data) -> const QualityTrial & {
+        QualityTrial &t = trials[idx][step];
+        if (!t.done)
+            t = trialEncode(streams[idx], stepQuality(step), data);
+        return t;
+    };
+    // A trial found already done has no data, the candidate is then
+    // only kept if it is at that step already
+    auto keepCandidate = [&](int idx, int step, OggChunks &data) {
+        if (!keep || (data.empty() && current[idx].step == step))
+            return;
+        current[idx].step = data.empty() ? -1 : step;
+        current[idx].data = std::move(data);
+    };
+    // Lowest step meeting the SNR, or the highest step
+    auto lowestStep = [&](int idx, double snr) {
+        int lo = 0;
+        int hi = qualitySteps - 1;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            OggChunks data;
+            if (trial(idx, mid, &data).snr >= snr) {
+                hi = mid;
+                keepCandidate(idx, mid, data);
+            } else
+                lo = mid + 1;
+        }
+        if (!trials[idx][lo].done) {
+            OggChunks data;
+            trial(idx, lo, &data);
+            keepCandidate(idx, lo, data);
+        }
+        return lo;
+    };
+    std::vector<int> steps(streams.size(), 0);
+    auto chooseSteps = [&](double snr) {
+        parallelFor(streams.size(), options.jobs, [&](int i) {
+            if (streams[i].duplicateOf < 0)
+                steps[i] = lowestStep(i, snr);
+        });
+        size_t total = 0;
+        for (size_t i = 0; i < streams.size(); ++i) {
+            if (streams[i].duplicateOf < 0)
+                total += trials[i][steps[i]].bytes;
+        }
+        return total;
+    };
+    // The current candidates at the chosen steps become the best encodes
+    auto keepBest = [&]() {
+        for (size_t i = 0; i < streams.size(); ++i) {
+            if (current[i].step == steps[i])
+                best[i] = std::move(current[i]);
+            else if (best[i].step != steps[i])
+                best[i] = KeptEncode();
+            current[i] = KeptEncode();
+        }
+    };
+
+    size_t total;
+    if (options.targetSnr > 0) {
+        total = chooseSteps(options.targetSnr);
+        keepBest();
+    } else {
+        // The sample data has to leave room for the rest of the file
+        std::ostringstream pdta;
+        RiffWriter writer(&pdta);
+        out = &writer;
+        writePdta();
+        writer.close();
+        out = nullptr;
+        size_t overhead = pdta.str().size() + 1024;
+        size_t budget = options.targetSize > overhead ? options.targetSize - overhead : 0;
+
+        double lo = 0;
+        double hi = 120;
+        total = chooseSteps(lo);
+        keepBest();
+        std::vector<int> bestSteps = steps;
+        if (total > budget)
+            printf("Size budget of %zu bytes cannot be met at the lowest quality\n",
+                   options.targetSize);
+        else {
+            while (hi - lo > 0.25) {
+                double mid = (lo + hi) / 2;
+                if (chooseSteps(mid) <= budget) {
+                    lo = mid;
+                    bestSteps = steps;
+                    keepBest();
+                } else
+                    hi = mid;
+            }
+        }
+        steps = bestSteps;
+        total = 0;
+        for (size_t i = 0; i < streams.size(); ++i) {
+            if (streams[i].duplicateOf < 0)
+                total += trials[i][steps[i]].bytes;
+        }
+        printf("Targeting %.1f dB SNR per sample within the size budget\n", lo);
+    }
+
+    // A kept encode at the chosen quality becomes the stream data and
+    // goes into the sample cache, other streams are encoded when written
+    double quality = 0;
+    int count = 0;
+    for (size_t i = 0; i < streams.size(); ++i) {
+        OggStream &stream = streams[i];
+        stream.quality = stepQuality(steps[i]);
+        if (stream.duplicateOf >= 0)
+            continue;
+        quality += stream.quality;
+        ++count;
+        if (best[i].step != steps[i])
+            continue;
+        stream.data = std::move(best[i].data);
+        stream.encoded = true;
+        if (options.cache)
+            options.cache->store(cacheKey(stream), stream.data);
+        if (stats) {
+            const QualityTrial &t = trials[i][steps[i]];
+            const Sample &s = samples[stream.sample];
+            stats->addSample({s.name, s.end > s.start ? s.end - s.start : 0,
+                              stream.right >= 0 ? 2 : 1, stream.quality, t.seconds, t.bytes,
+                              false});
+        }
+    }
+    printf("Chose sample qualities averaging %.2f, %zu bytes of sample data\n",
+           count ? quality / count : 0, total);
+}
+
+//---------------------------------------------------------
+//   streamChannel
+//    The right sample of a 2 channel stream is its second
+//    channel, any other sample the first
+//---------------------------------------------------------
+
+static int streamChannel(const Sample &s, size_t channels) {
+    return (s.sampletype & 2) && channels > 1 ? 1 : 0;
+}
+
+//---------------------------------------------------------
+//   isCompressed
+//---------------------------------------------------------
+
+bool SoundFont::isCompressed() const {
+    if (version.major != 3)
+        return false;
+    for (const Sample &s : samples) {
+        if (s.sampletype & 0x10)
+            return true;
+    }
+    return false;
+}
+
+//---------------------------------------------------------
+//   decompress
+//    Write a SoundFont 2 file from a compressed font. The
+//    sample streams are decoded on up to `jobs` threads.
+//---------------------------------------------------------
+
+bool SoundFont::decompress(std::ostream *f, int jobs) {
+    if (jobs <= 0)
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    if (!sampleData.isOpen() && !sampleData.open(path, samplePos, sampleLen)) {
+        fprintf(stderr, "cannot read sample data from <%s>\n", path.c_str());
+        return false;
+    }
     try {
-        file->write("RIFF", 4);
-        riffLenPos = file->tellg();
-        writeDword(0);
-        file->write("sfbk", 4);
-
-        file->write("LIST", 4);
-        listLenPos = file->tellg();
-        writeDword(0);
-        file->write("INFO", 4);
-
-        writeIfil();
-        if (name)
-            writeStringSection("INAM", name);
-        if (engine)
-            writeStringSection("isng", engine);
-        if (product)
-            writeStringSection("IPRD", product);
-        if (creator)
-            writeStringSection("IENG", creator);
-        if (tools)
-            writeStringSection("ISFT", tools);
-        if (date)
-            writeStringSection("ICRD", date);
-        if (comment)
-            writeStringSection("ICMT", comment);
-        if (copyright)
-            writeStringSection("ICOP", copyright);
-
-        int pos = file->tellg();
-        file->seekg(listLenPos);
-        writeDword(pos - listLenPos - 4);
-        file->seekg(pos);
-
-        file->write("LIST", 4);
-        listLenPos = file->tellg();
-        writeDword(0);
-        file->write("sdta", 4);
-        writeSmpl();
-        pos = file->tellg();
-        file->seekg(listLenPos);
-        writeDword(pos - listLenPos - 4);
-        file->seekg(pos);
-
-        file->write("LIST", 4);
-        listLenPos = file->tellg();
-        writeDword(0);
-        file->write("pdta", 4);
-
-        writePhdr();
-        writeBag("pbag", &pZones);
-        writeMod("pmod", &pZones);
-        writeGen("pgen", &pZones);
-        writeInst();
-        writeBag("ibag", &iZones);
-        writeMod("imod", &iZones);
-        writeGen("igen", &iZones);
-        writeShdr();
-
-        pos = file->tellg();
-        file->seekg(listLenPos);
-        writeDword(pos - listLenPos - 4);
-        file->seekg(pos);
-
-        int endPos = file->tellg();
-        file->seekg(riffLenPos);
-        writeDword(endPos - riffLenPos - 4);
+        PhaseTimer timer(stats, "decode");
+        decodeSamples(jobs);
+    } catch (std::string s) {
+        printf("decompress sf file failed: %s\n", s.c_str());
+        return false;
+    }
+    streams.clear();
+    writeCompressed = false;
+    version.major = 2;
+    bool ok = writePrepared(f);
+    std::vector<std::vector<int16_t>>().swap(decodedPcm);
+    samplePcm.clear();
+    return ok;
+}
+
+//---------------------------------------------------------
+//   decodeSamples
+//    Stereo pairs and deduplicated samples share one stream,
+//    which is decoded once. The right sample of a stereo
+//    stream takes its second channel.
+//---------------------------------------------------------
+
+void SoundFont::decodeSamples(int jobs) {
+    std::map<std::pair<unsigned, unsigned>, int> streamOf;
+    std::vector<std::pair<unsigned, unsigned>> ranges;
+    std::vector<int> sampleStream(samples.size());
+    for (size_t i = 0; i < samples.size(); ++i) {
+        const Sample &s = samples[i];
+        if (!(s.sampletype & 0x10))
+            throw(std::string("sample not compressed: ") + s.name);
+        auto [it, added] = streamOf.emplace(std::make_pair(s.start, s.end), ranges.size());
+        if (added)
+            ranges.push_back(it->first);
+        sampleStream[i] = it->second;
+    }
+
+    std::vector<std::vector<std::vector<int16_t>>> channels(ranges.size());
+    parallelFor(ranges.size(), jobs, [&](int i) {
+        std::span<const char> data = sampleData.bytes(ranges[i].first, ranges[i].second);
+        if (!decodeOgg(data, &channels[i]) || channels[i].empty())
+            throw(std::string("cannot decode sample stream"));
+    });
+
+    std::vector<int> firstPcm(ranges.size());
+    decodedPcm.clear();
+    for (size_t i = 0; i < channels.size(); ++i) {
+        firstPcm[i] = decodedPcm.size();
+        for (std::vector<int16_t> &pcm : channels[i])
+            decodedPcm.push_back(std::move(pcm));
+    }
+    samplePcm.resize(samples.size());
+    for (size_t i = 0; i < samples.size(); ++i) {
+        int stream = sampleStream[i];
+        samplePcm[i] = firstPcm[stream] + streamChannel(samples[i], channels[stream].size());
+    }
+}
+
+//---------------------------------------------------------
+//   openSamples
+//---------------------------------------------------------
+
+bool SoundFont::openSamples(size_t cacheBytes) {
+    if (!sampleData.isOpen() && !sampleData.open(path, samplePos, sampleLen)) {
+        fprintf(stderr, "cannot read sample data from <%s>\n", path.c_str());
+        return false;
+    }
+    decodeCache = std::make_unique<DecodeCache>(cacheBytes);
+    return true;
+}
+
+//---------------------------------------------------------
+//   loadSample
+//    Uncompressed samples are views of the mapped smpl chunk.
+//    Throws if the sample cannot be decoded.
+//---------------------------------------------------------
+
+SamplePcm SoundFont::loadSample(int idx) {
+    if (idx < 0 || idx >= (int)samples.size())
+        throw(std::string("sample index out of range"));
+    if (!decodeCache)
+        throw(std::string("sample data not open"));
+    const Sample &s = samples[idx];
+    SamplePcm result;
+    if (version.major != 3 || !(s.sampletype & 0x10)) {
+        result.pcm = sampleData.view(s.start, s.end);
+        return result;
+    }
+    uint64_t key = (uint64_t)s.start << 32 | s.end;
+    result.stream = decodeCache->get(key, [this, &s]() {
+        DecodedStream stream;
+        if (!decodeOgg(sampleData.bytes(s.start, s.end), &stream) || stream.empty())
+            throw(std::string("cannot decode sample stream"));
+        return stream;
+    });
+    result.pcm = (*result.stream)[streamChannel(s, result.stream->size())];
+    return result;
+}
+
+//---------------------------------------------------------
+//   sampleStream
+//    Compressed data of a sample after openSamples(), empty
+//    if the sample is not compressed
+//---------------------------------------------------------
+
+std::span<const char> SoundFont::sampleStream(int idx) const {
+    const Sample &s = samples[idx];
+    if (version.major != 3 || !(s.sampletype & 0x10) || !sampleData.isOpen())
+        return {};
+    return sampleData.bytes(s.start, s.end);
+}
+
+//---------------------------------------------------------
+//   streamHash
+//---------------------------------------------------------
+
+uint64_t SoundFont::streamHash(const OggStream &stream) const {
+    const Sample &s = samples[stream.sample];
+    std::span<const int16_t> pcm = sampleData.view(s.start, s.end);
+    uint64_t h = hash64(pcm.data(), pcm.size_bytes(), s.samplerate);
+    if (stream.right >= 0) {
+        const Sample &r = samples[stream.right];
+        std::span<const int16_t> rpcm = sampleData.view(r.start, r.end);
+        h = hash64(rpcm.data(), rpcm.size_bytes(), h);
+    }
+    return h;
+}
+
+//---------------------------------------------------------
+//   streamKey
+//    Hash of the sample data and the encoder settings of the
+//    stream at the given quality. Its low 31 bits are the ogg
+//    serial number, and all of it goes into the Vorbis
+//    comment header for PreviousFont to match.
+//---------------------------------------------------------
+
+uint64_t SoundFont::streamKey(const OggStream &stream, double quality) const {
+    struct {
+        uint64_t pcm;
+        double quality;
+        double amp;
+    } fields{stream.dataHash, quality, options.oggAmp};
+    return hash64(&fields, sizeof(fields));
+}
+
+//---------------------------------------------------------
+//   sameStreamData
+//    True if the two streams would encode to the same data
+//---------------------------------------------------------
+
+bool SoundFont::sameStreamData(const OggStream &a, const OggStream &b) const {
+    auto samePcm = [this](const Sample &x, const Sample &y) {
+        std::span<const int16_t> xpcm = sampleData.view(x.start, x.end);
+        std::span<const int16_t> ypcm = sampleData.view(y.start, y.end);
+        return xpcm.size() == ypcm.size() && !memcmp(xpcm.data(), ypcm.data(), xpcm.size_bytes());
+    };
+    const Sample &as = samples[a.sample];
+    const Sample &bs = samples[b.sample];
+    if (as.samplerate != bs.samplerate || (a.right >= 0) != (b.right >= 0))
+        return false;
+    if (!samePcm(as, bs))
+        return false;
+    return a.right < 0 || samePcm(samples[a.right], samples[b.right]);
+}
+
+//---------------------------------------------------------
+//   dedupeStreams
+//    Point every stream whose sample data repeats an earlier
+//    stream at that stream, so it is encoded only once
+//---------------------------------------------------------
+
+void SoundFont::dedupeStreams() {
+    std::unordered_map<uint64_t, std::vector<int>> seen;
+    for (int i = 0; i < (int)streams.size(); ++i) {
+        std::vector<int> &candidates = seen[streams[i].dataHash];
+        for (int j : candidates) {
+            if (sameStreamData(streams[i], streams[j])) {
+                streams[i].duplicateOf = j;
+                break;
+            }
+        }
+        if (streams[i].duplicateOf < 0)
+            candidates.push_back(i);
+        releasePcm(streams[i]);
+    }
+}
+
+//---------------------------------------------------------
+//   streamFrames
+//    Frames of PCM, counting every channel, that encoding
+//    the stream has to analyse
+//---------------------------------------------------------
+
+size_t SoundFont::streamFrames(int idx) const {
+    const OggStream &stream = streams[idx];
+    if (stream.duplicateOf >= 0)
+        return 0;
+    const Sample &s = samples[stream.sample];
+    size_t frames = s.end > s.start ? s.end - s.start : 0;
+    return stream.right >= 0 ? frames * 2 : frames;
+}
+
+//---------------------------------------------------------
+//   encodeStream
+//    Encode one stream ahead of writePrepared. Different
+//    streams may be encoded concurrently. Throws if the
+//    encoder cannot be set up for the stream.
+//---------------------------------------------------------
+
+void SoundFont::encodeStream(int idx) {
+    OggStream &stream = streams[idx];
+    if (stream.duplicateOf >= 0 || stream.encoded)
+        return;
+    ChunkSink sink;
+    if (!compressStream(stream, sink))
+        throw(std::string("cannot encode sample ") + samples[stream.sample].name);
+    stream.data = sink.take();
+    stream.encoded = true;
+}
+
+//---------------------------------------------------------
+//   writePrepared
+//---------------------------------------------------------
+
+bool SoundFont::writePrepared(std::ostream *f) {
+    RiffWriter writer(f);
+    out = &writer;
+    try {
+        if (options.streaming && writeCompressed) {
+            writeStreamed();
+            out = nullptr;
+            return true;
+        }
+        size_t riffLenPos = out->beginChunk("RIFF");
+        write("sfbk", 4);
+        writeInfo();
+
+        {
+            PhaseTimer timer(stats, "write sdta");
+            size_t listLenPos = out->beginChunk("LIST");
+            write("sdta", 4);
+            writeSmpl();
+            out->endChunk(listLenPos);
+        }
+        {
+            PhaseTimer timer(stats, "write pdta");
+            writePdta();
+        }
+
+        out->endChunk(riffLenPos);
+        PhaseTimer timer(stats, "flush");
+        out->close();
     } catch (std::string s) {
         printf("write sf file failed: %s\n", s.c_str());
+        out = nullptr;
         return false;
     }
+    out = nullptr;
     return true;
 }
 
 //---------------------------------------------------------
-//   write
+//   writePrepared
+//    Write to a seekable file. Streams not encoded yet are
+//    encoded here on options.jobs threads.
+//---------------------------------------------------------
+
+bool SoundFont::writePrepared(OutputFile *f) {
+    if (!writeCompressed) {
+        fprintf(stderr, "positional writes need compressed output\n");
+        return false;
+    }
+    try {
+        writePositional(f);
+    } catch (std::string s) {
+        printf("write sf file failed: %s\n", s.c_str());
+        return false;
+    }
+    return true;
+}
+
+//---------------------------------------------------------
+//   writePositional
+//    Everything in front of the sample data has a fixed
+//    length, so a stream has its final offset as soon as all
+//    earlier streams are encoded, and the encoder threads
+//    write the streams at their offsets concurrently. pdta
+//    and the chunk headers follow once the last stream is
+//    in; nothing is written twice.
+//---------------------------------------------------------
+
+void SoundFont::writePositional(OutputFile *f) {
+    std::string infoData = infoChunk();
+    size_t dataStart = 12 + infoData.size() + 12 + 8;
+    std::vector<size_t> lengths(streams.size());
+    std::vector<size_t> offsets(streams.size());
+    size_t dataEnd = dataStart;
+    {
+        PhaseTimer timer(stats, "encode");
+        encodeStreams(
+            [&](int idx) {
+                lengths[idx] = chunksSize(streams[idx].data);
+                offsets[idx] = dataEnd;
+                dataEnd += lengths[idx];
+            },
+            [&](int idx) {
+                size_t pos = offsets[idx];
+                for (const std::vector<char> &chunk : streams[idx].data) {
+                    f->writeAt(pos, chunk.data(), chunk.size());
+                    pos += chunk.size();
+                }
+            });
+    }
+    unsigned smplLen = placeStreams(lengths);
+    reportDuplicates();
+
+    std::string pdtaData;
+    {
+        PhaseTimer timer(stats, "write pdta");
+        pdtaData = pdtaChunk();
+    }
+    PhaseTimer timer(stats, "flush");
+    size_t pdtaPos = dataStart + RiffWriter::padded(smplLen);
+    f->preallocate(pdtaPos + pdtaData.size());
+    if (pdtaPos > dataEnd)
+        f->writeAt(dataEnd, "", 1);
+    f->writeAt(pdtaPos, pdtaData.data(), pdtaData.size());
+
+    std::ostringstream head;
+    RiffWriter writer(&head);
+    out = &writer;
+    writeHeaders(infoData, smplLen, pdtaData.size());
+    writer.close();
+    out = nullptr;
+    std::string headData = head.str();
+    f->writeAt(0, headData.data(), headData.size());
+}
+
+//---------------------------------------------------------
+//   writeStreamed
+//    For output that cannot seek back: every stream is
+//    encoded already, so the samples are placed and every
+//    chunk length is known before the first header goes out.
 //---------------------------------------------------------
 
-void SoundFont::write(const char *p, int n) {
-    if (file->write(p, n).fail())
-        throw(std::string("write error"));
+void SoundFont::writeStreamed() {
+    std::vector<size_t> lengths(streams.size());
+    for (size_t i = 0; i < streams.size(); ++i) {
+        if (streams[i].duplicateOf < 0 && !streams[i].encoded)
+            throw(std::string("stream not encoded"));
+        lengths[i] = chunksSize(streams[i].data);
+    }
+    unsigned smplLen = placeStreams(lengths);
+    reportDuplicates();
+
+    RiffWriter *target = out;
+    std::string infoData = infoChunk();
+    std::string pdtaData;
+    {
+        PhaseTimer timer(stats, "write pdta");
+        pdtaData = pdtaChunk();
+    }
+    out = target;
+
+    PhaseTimer timer(stats, "write sdta");
+    writeHeaders(infoData, smplLen, pdtaData.size());
+    for (OggStream &stream : streams) {
+        for (const std::vector<char> &chunk : stream.data)
+            out->write(chunk.data(), chunk.size());
+        OggChunks().swap(stream.data);
+    }
+    out->pad(smplLen);
+    out->write(pdtaData.data(), pdtaData.size());
+    out->close();
+}
+
+//---------------------------------------------------------
+//   writeHeaders
+//    Everything in front of the sample data, for a font
+//    whose chunk lengths are all known
+//---------------------------------------------------------
+
+void SoundFont::writeHeaders(const std::string &info, unsigned smplLen, size_t pdtaLen) {
+    unsigned sdtaLen = 4 + 8 + RiffWriter::padded(smplLen);
+    out->writeHeader("RIFF", 4 + info.size() + 8 + sdtaLen + pdtaLen);
+    write("sfbk", 4);
+    out->write(info.data(), info.size());
+    out->writeHeader("LIST", sdtaLen);
+    write("sdta", 4);
+    out->writeHeader("smpl", smplLen);
 }
 
+//---------------------------------------------------------
+//   infoChunk
+//    The INFO list assembled in memory
+//---------------------------------------------------------
+
+std::string SoundFont::infoChunk() {
+    std::ostringstream data;
+    RiffWriter writer(&data);
+    out = &writer;
+    writeInfo();
+    writer.close();
+    out = nullptr;
+    return data.str();
+}
+
+//---------------------------------------------------------
+//   pdtaChunk
+//    The pdta list assembled in memory, after the samples
+//    are placed
+//---------------------------------------------------------
+
+std::string SoundFont::pdtaChunk() {
+    std::ostringstream data;
+    RiffWriter writer(&data);
+    out = &writer;
+    writePdta();
+    writer.close();
+    out = nullptr;
+    return data.str();
+}
+
+//---------------------------------------------------------
+//   writeInfo
+//---------------------------------------------------------
+
+void SoundFont::writeInfo() {
+    size_t listLenPos = out->beginChunk("LIST");
+    write("INFO", 4);
+
+    writeIfil();
+    if (name)
+        writeStringSection("INAM", name);
+    if (engine)
+        writeStringSection("isng", engine);
+    if (product)
+        writeStringSection("IPRD", product);
+    if (creator)
+        writeStringSection("IENG", creator);
+    if (tools)
+        writeStringSection("ISFT", tools);
+    if (date)
+        writeStringSection("ICRD", date);
+    if (comment)
+        writeStringSection("ICMT", comment);
+    if (copyright)
+        writeStringSection("ICOP", copyright);
+    for (const RawChunk &chunk : infoChunks) {
+        out->writeHeader(chunk.id, chunk.data.size());
+        write((const char *)chunk.data.data(), chunk.data.size());
+        out->pad(chunk.data.size());
+    }
+    out->endChunk(listLenPos);
+}
+
+//---------------------------------------------------------
+//   write
+//---------------------------------------------------------
+
+void SoundFont::write(const char *p, int n) { out->write(p, n); }
+
 //---------------------------------------------------------
 //   writeStringSection
 //---------------------------------------------------------
@@ -685,6 +1424,26 @@ void SoundFont::writeStringSection(const char *fourcc, char *s) {
     }
 }
 
+//---------------------------------------------------------
+//   writePdta
+//---------------------------------------------------------
+
+void SoundFont::writePdta() {
+    size_t listLenPos = out->beginChunk("LIST");
+    write("pdta", 4);
+
+    writePhdr();
+    writeBag("pbag", &pZones);
+    writeMod("pmod", &pZones);
+    writeGen("pgen", &pZones);
+    writeInst();
+    writeBag("ibag", &iZones);
+    writeMod("imod", &iZones);
+    writeGen("igen", &iZones);
+    writeShdr();
+    out->endChunk(listLenPos);
+}
+
 //---------------------------------------------------------
 //   writeIfil
 //---------------------------------------------------------
@@ -707,43 +1466,205 @@ void SoundFont::writeIfil() {
 //---------------------------------------------------------
 
 void SoundFont::writeSmpl() {
-    write("smpl", 4);
-
-    int pos = file->tellg();
-    writeDword(0);
-    int sampleLen = 0;
+    size_t lenPos = out->beginChunk("smpl");
+    unsigned sampleLen = 0;
     if (writeCompressed) {
-        for (Sample *s : samples) {
-            s->sampletype |= 0x10;
-            int len = writeCompressedSample(s);
-            s->start = sampleLen;
-            sampleLen += len;
-            s->end = sampleLen;
+        WriterSink sink(out);
+        std::vector<size_t> lengths(streams.size());
+        if (options.jobs > 1) {
+            // Encoded on the worker threads and written out in order
+            encodeStreams(
+                [&](int idx) {
+                    lengths[idx] = chunksSize(streams[idx].data);
+                    for (const std::vector<char> &chunk : streams[idx].data)
+                        sink.write(chunk.data(), chunk.size());
+                },
+                [](int) {});
+        } else {
+            // Streams encoded ahead are copied out, the others are
+            // encoded here with their pages going straight to the output
+            for (size_t i = 0; i < streams.size(); ++i) {
+                OggStream &stream = streams[i];
+                if (stream.duplicateOf >= 0)
+                    continue;
+                size_t pos = sink.size();
+                if (stream.encoded) {
+                    for (const std::vector<char> &chunk : stream.data)
+                        sink.write(chunk.data(), chunk.size());
+                    OggChunks().swap(stream.data);
+                } else {
+                    if (!compressStream(stream, sink))
+                        throw(std::string("cannot encode sample ") + samples[stream.sample].name);
+                    releasePcm(stream);
+                }
+                lengths[i] = sink.size() - pos;
+            }
         }
+        sampleLen = placeStreams(lengths);
+        reportDuplicates();
     } else {
-        char *buffer = new char[sampleLen];
-        std::fstream f(path);
-        if (!f.is_open())
-            throw std::runtime_error("cannot open " + path);
-        for (Sample *s : samples) {
-            f.seekg(samplePos + s->start * sizeof(short));
-
-            int len = (s->end - s->start) * sizeof(short);
-            f.read(buffer, len);
-            write(buffer, len);
-            s->start = sampleLen / sizeof(short);
+        // Every sample is followed by 46 zero valued data points
+        static const int16_t silence[46] = {};
+        for (size_t i = 0; i < samples.size(); ++i) {
+            Sample &s = samples[i];
+            std::span<const int16_t> pcm = decodedPcm.empty()
+                                               ? sampleData.view(s.start, s.end)
+                                               : std::span<const int16_t>(decodedPcm[samplePcm[i]]);
+            int len = pcm.size_bytes();
+            write(reinterpret_cast<const char *>(pcm.data()), len);
+            s.sampletype &= ~0x10;
+            s.start = sampleLen / sizeof(short);
             sampleLen += len;
-            s->end = sampleLen / sizeof(short);
-            s->loopstart += s->start;
-            s->loopend += s->start;
+            s.end = sampleLen / sizeof(short);
+            s.loopstart += s.start;
+            s.loopend += s.start;
+            write(reinterpret_cast<const char *>(silence), sizeof(silence));
+            sampleLen += sizeof(silence);
         }
-        f.close();
-        delete[] buffer;
     }
-    int npos = file->tellg();
-    file->seekg(pos);
-    writeDword(npos - pos - 4);
-    file->seekg(npos);
+    out->endChunk(lenPos);
+}
+
+//---------------------------------------------------------
+//   encodeStreams
+//    Encode the streams on options.jobs threads as a
+//    pipeline. Once all earlier streams are placed, a stream
+//    is placed, under a lock and in stream order, then
+//    emitted outside the lock and its data released. With
+//    options.maxMemory, a stream is only started while the
+//    PCM being encoded and the data not yet emitted stay
+//    within that budget. The first stream not yet placed is
+//    always started, so the pipeline cannot stall.
+//---------------------------------------------------------
+
+void SoundFont::encodeStreams(const std::function<void(int)> &place,
+                              const std::function<void(int)> &emit) {
+    std::vector<bool> done(streams.size());
+    std::vector<size_t> held(streams.size()); // encoded bytes until emitted
+    size_t next = 0;                          // first stream not placed
+    size_t inFlight = 0;                      // bytes against options.maxMemory
+    bool failed = false;
+    std::mutex mutex;
+    std::condition_variable released;
+
+    parallelFor(streams.size(), options.jobs, [&](int i) {
+        OggStream &stream = streams[i];
+        size_t pcm = stream.encoded ? 0 : streamFrames(i) * sizeof(int16_t);
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            released.wait(lock, [&] {
+                return failed || !options.maxMemory || (size_t)i == next ||
+                       inFlight + pcm <= options.maxMemory;
+            });
+            if (failed)
+                return;
+            inFlight += pcm;
+        }
+        try {
+            if (!stream.encoded) {
+                encodeStream(i);
+                releasePcm(stream);
+            }
+            std::vector<int> ready;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                held[i] = chunksSize(stream.data);
+                inFlight = inFlight - pcm + held[i];
+                done[i] = true;
+                for (; next < streams.size() && done[next]; ++next) {
+                    if (streams[next].duplicateOf < 0) {
+                        place(next);
+                        ready.push_back(next);
+                    }
+                }
+            }
+            released.notify_all();
+            for (int idx : ready) {
+                emit(idx);
+                OggChunks().swap(streams[idx].data);
+                std::lock_guard<std::mutex> lock(mutex);
+                inFlight -= held[idx];
+            }
+            if (!ready.empty())
+                released.notify_all();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            failed = true;
+            released.notify_all();
+            throw;
+        }
+    });
+}
+
+//---------------------------------------------------------
+//   releasePcm
+//    With a memory budget, drop the mapped PCM of a stream
+//    once it has been read
+//---------------------------------------------------------
+
+void SoundFont::releasePcm(const OggStream &stream) {
+    if (!options.maxMemory)
+        return;
+    for (int idx : {stream.sample, stream.right}) {
+        if (idx >= 0)
+            sampleData.release(samples[idx].start, samples[idx].end);
+    }
+}
+
+//---------------------------------------------------------
+//   placeStreams
+//    Lay out streams of the given compressed lengths one
+//    after another in smpl. Duplicates share the data of
+//    their original. Returns the length of smpl.
+//---------------------------------------------------------
+
+unsigned SoundFont::placeStreams(const std::vector<size_t> &lengths) {
+    unsigned smplLen = 0;
+    for (size_t i = 0; i < streams.size(); ++i) {
+        const OggStream &stream = streams[i];
+        if (stream.duplicateOf >= 0) {
+            const Sample &orig = samples[streams[stream.duplicateOf].sample];
+            placeStream(stream, orig.start, orig.end);
+            continue;
+        }
+        placeStream(stream, smplLen, smplLen + lengths[i]);
+        smplLen += lengths[i];
+    }
+    return smplLen;
+}
+
+//---------------------------------------------------------
+//   placeStream
+//    Point the samples of a stream at its data in smpl
+//---------------------------------------------------------
+
+void SoundFont::placeStream(const OggStream &stream, unsigned start, unsigned end) {
+    for (int idx : {stream.sample, stream.right}) {
+        if (idx < 0)
+            continue;
+        Sample &s = samples[idx];
+        s.sampletype |= 0x10;
+        s.start = start;
+        s.end = end;
+    }
+}
+
+//---------------------------------------------------------
+//   reportDuplicates
+//---------------------------------------------------------
+
+void SoundFont::reportDuplicates() const {
+    int duplicates = 0;
+    size_t duplicateBytes = 0;
+    for (const OggStream &stream : streams) {
+        if (stream.duplicateOf < 0)
+            continue;
+        const Sample &orig = samples[streams[stream.duplicateOf].sample];
+        duplicates += stream.right >= 0 ? 2 : 1;
+        duplicateBytes += orig.end - orig.start;
+    }
+    if (duplicates)
+        printf("Deduplicated %d samples, %zu bytes saved\n", duplicates, duplicateBytes);
 }
 
 //---------------------------------------------------------
@@ -755,12 +1676,13 @@ void SoundFont::writePhdr() {
     int n = presets.size();
     writeDword((n + 1) * 38);
     int zoneIdx = 0;
-    for (const Preset *p : presets) {
-        writePreset(zoneIdx, p);
-        zoneIdx += p->zones.size();
+    for (const Preset &p : presets) {
+        writePreset(zoneIdx, &p);
+        zoneIdx += p.zoneCount;
     }
+    // End of preset record teminates "phdr" chunk
     Preset p;
-    memset(&p, 0, sizeof(p));
+    strcpy(p.name, "EOP");
     writePreset(zoneIdx, &p);
 }
 
@@ -769,11 +1691,7 @@ void SoundFont::writePhdr() {
 //---------------------------------------------------------
 
 void SoundFont::writePreset(int zoneIdx, const Preset *preset) {
-    if (preset->name)
-        write(preset->name, 20);
-    else
-        // End of preset message teminates "phdr" chunk
-        write("EOP", 20);
+    write(preset->name, 20);
     writeWord(preset->preset);
     writeWord(preset->bank);
     writeWord(zoneIdx);
@@ -786,17 +1704,17 @@ void SoundFont::writePreset(int zoneIdx, const Preset *preset) {
 //   writeBag
 //---------------------------------------------------------
 
-void SoundFont::writeBag(const char *fourcc, std::vector<Zone *> *zones) {
+void SoundFont::writeBag(const char *fourcc, const ZoneList *zones) {
     write(fourcc, 4);
-    int n = zones->size();
+    int n = zones->zones.size();
     writeDword((n + 1) * 4);
     int gIndex = 0;
     int pIndex = 0;
-    for (const Zone *z : *zones) {
+    for (const Zone &z : zones->zones) {
         writeWord(gIndex);
         writeWord(pIndex);
-        gIndex += z->generators.size();
-        pIndex += z->modulators.size();
+        gIndex += z.genCount;
+        pIndex += z.modCount;
     }
     writeWord(gIndex);
     writeWord(pIndex);
@@ -806,16 +1724,16 @@ void SoundFont::writeBag(const char *fourcc, std::vector<Zone *> *zones) {
 //   writeMod
 //---------------------------------------------------------
 
-void SoundFont::writeMod(const char *fourcc, const std::vector<Zone *> *zones) {
+void SoundFont::writeMod(const char *fourcc, const ZoneList *zones) {
     write(fourcc, 4);
     int n = 0;
-    for (const Zone *z : *zones)
-        n += z->modulators.size();
+    for (const Zone &z : zones->zones)
+        n += z.modCount;
     writeDword((n + 1) * 10);
 
-    for (const Zone *zone : *zones) {
-        for (const ModulatorList *m : zone->modulators)
-            writeModulator(m);
+    for (const Zone &zone : zones->zones) {
+        for (const ModulatorList &m : zones->modulatorsOf(zone))
+            writeModulator(&m);
     }
     ModulatorList mod;
     memset(&mod, 0, sizeof(mod));
@@ -838,16 +1756,16 @@ void SoundFont::writeModulator(const ModulatorList *m) {
 //   writeGen
 //---------------------------------------------------------
 
-void SoundFont::writeGen(const char *fourcc, std::vector<Zone *> *zones) {
+void SoundFont::writeGen(const char *fourcc, const ZoneList *zones) {
     write(fourcc, 4);
     int n = 0;
-    for (const Zone *z : *zones)
-        n += z->generators.size();
+    for (const Zone &z : zones->zones)
+        n += z.genCount;
     writeDword((n + 1) * 4);
 
-    for (const Zone *zone : *zones) {
-        for (const GeneratorList *g : zone->generators)
-            writeGenerator(g);
+    for (const Zone &zone : zones->zones) {
+        for (const GeneratorList &g : zones->generatorsOf(zone))
+            writeGenerator(&g);
     }
     GeneratorList gen;
     memset(&gen, 0, sizeof(gen));
@@ -878,12 +1796,13 @@ void SoundFont::writeInst() {
     int n = instruments.size();
     writeDword((n + 1) * 22);
     int zoneIdx = 0;
-    for (const Instrument *p : instruments) {
-        writeInstrument(zoneIdx, p);
-        zoneIdx += p->zones.size();
+    for (const Instrument &p : instruments) {
+        writeInstrument(zoneIdx, &p);
+        zoneIdx += p.zoneCount;
     }
+    // End of instrument record teminates "inst" chunk
     Instrument p;
-    memset(&p, 0, sizeof(p));
+    strcpy(p.name, "EOI");
     writeInstrument(zoneIdx, &p);
 }
 
@@ -892,11 +1811,7 @@ void SoundFont::writeInst() {
 //---------------------------------------------------------
 
 void SoundFont::writeInstrument(int zoneIdx, const Instrument *instrument) {
-    if (instrument->name)
-        write(instrument->name, 20);
-    else
-        // End of instrument message teminates "inst" chunk
-        write("EOI", 20);
+    write(instrument->name, 20);
     writeWord(zoneIdx);
 }
 
@@ -907,10 +1822,11 @@ void SoundFont::writeInstrument(int zoneIdx, const Instrument *instrument) {
 void SoundFont::writeShdr() {
     write("shdr", 4);
     writeDword(46 * (samples.size() + 1));
-    for (const Sample *s : samples)
-        writeSample(s);
+    for (const Sample &s : samples)
+        writeSample(&s);
+    // End of sample record teminates "shdr" chunk
     Sample s;
-    memset(&s, 0, sizeof(s));
+    strcpy(s.name, "EOS");
     writeSample(&s);
 }
 
@@ -919,11 +1835,7 @@ void SoundFont::writeShdr() {
 //---------------------------------------------------------
 
 void SoundFont::writeSample(const Sample *s) {
-    if (s->name)
-        write(s->name, 20);
-    else
-        // End of sample message teminates "shdr" chunk
-        write("EOS", 20);
+    write(s->name, 20);
     writeDword(s->start);
     writeDword(s->end);
     writeDword(s->loopstart);
@@ -931,25 +1843,127 @@ void SoundFont::writeSample(const Sample *s) {
     writeDword(s->samplerate);
     writeByte(s->origpitch);
     writeChar(s->pitchadj);
-    writeWord(0);
+    writeWord(s->sampleLink);
     writeWord(s->sampletype);
 }
 
 //---------------------------------------------------------
-//   writeCompressedSample
+//   stereoPartner
+//    Index of the right sample linked to the left sample at
+//    sampleIdx, if the two can share one stereo stream.
+//    Returns -1 otherwise.
+//---------------------------------------------------------
+
+int SoundFont::stereoPartner(int sampleIdx) const {
+    const Sample *left = &samples[sampleIdx];
+    if (!(left->sampletype & 4) || left->sampletype & 0x8000)
+        return -1;
+    int idx = left->sampleLink;
+    if (idx < 0 || idx >= (int)samples.size() || idx == sampleIdx)
+        return -1;
+    const Sample *right = &samples[idx];
+    if (!(right->sampletype & 2) || right->sampleLink != sampleIdx)
+        return -1;
+    if (right->samplerate != left->samplerate ||
+        right->end - right->start != left->end - left->start)
+        return -1;
+    return idx;
+}
+
+//---------------------------------------------------------
+//   compressStream
+//    encodeOrLoad, recording the stream in the stats
 //---------------------------------------------------------
 
-int SoundFont::writeCompressedSample(Sample *s) {
-    std::fstream f(path);
-    if (!f.is_open()) {
-        fprintf(stderr, "cannot open <%s>\n", path.c_str());
-        return 0;
+bool SoundFont::compressStream(const OggStream &stream, OggSink &sink) {
+    if (!stats)
+        return encodeOrLoad(stream, sink, nullptr);
+    const Sample &s = samples[stream.sample];
+    auto start = std::chrono::steady_clock::now();
+    size_t pos = sink.size();
+    bool cached = false;
+    bool ok = encodeOrLoad(stream, sink, &cached);
+    std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+    stats->addSample({s.name, s.end > s.start ? s.end - s.start : 0, stream.right >= 0 ? 2 : 1,
+                      stream.quality, time.count(), sink.size() - pos, cached});
+    return ok;
+}
+
+//---------------------------------------------------------
+//   cacheKey
+//    Key of the stream at its quality in the sample cache
+//---------------------------------------------------------
+
+std::string SoundFont::cacheKey(const OggStream &stream) const {
+    const Sample &s = samples[stream.sample];
+    std::span<const int16_t> rpcm;
+    if (stream.right >= 0)
+        rpcm = sampleData.view(samples[stream.right].start, samples[stream.right].end);
+    return SampleCache::key(sampleData.view(s.start, s.end), rpcm, s.samplerate, stream.quality,
+                            options.oggAmp);
+}
+
+//---------------------------------------------------------
+//   encodeOrLoad
+//    Encode the stream, or copy it from the previous output
+//    or the sample cache
+//---------------------------------------------------------
+
+bool SoundFont::encodeOrLoad(const OggStream &stream, OggSink &sink, bool *cached) {
+    const Sample *s = &samples[stream.sample];
+    const Sample *right = stream.right >= 0 ? &samples[stream.right] : nullptr;
+    if (options.update && options.update->load(stream.key, right ? 2 : 1, s->samplerate,
+                                               s->end - s->start, sink)) {
+        if (cached)
+            *cached = true;
+        return true;
+    }
+    if (!options.cache)
+        return compressSample(s, right, stream.key, stream.quality, sink);
+
+    std::string key = cacheKey(stream);
+    if (options.cache->load(key, sink)) {
+        if (cached)
+            *cached = true;
+        return true;
     }
-    f.seekg(samplePos + s->start * sizeof(short));
-    int samples = s->end - s->start;
-    short *ibuffer = new short[samples];
-    f.read((char *)ibuffer, samples * sizeof(short));
-    f.close();
+
+    ChunkSink encoded;
+    if (!compressSample(s, right, stream.key, stream.quality, encoded))
+        return false;
+    OggChunks data = encoded.take();
+    options.cache->store(key, data);
+    for (const std::vector<char> &chunk : data)
+        sink.write(chunk.data(), chunk.size());
+    return true;
+}
+
+//---------------------------------------------------------
+//   writePage
+//---------------------------------------------------------
+
+static void writePage(OggSink &sink, const ogg_page &og) {
+    sink.write((const char *)og.header, og.header_len);
+    sink.write((const char *)og.body, og.body_len);
+}
+
+//---------------------------------------------------------
+//   compressSample
+//    Encode one sample as an ogg vorbis stream into sink.
+//    If right is given, the two samples are encoded as the
+//    left and right channel of one stereo stream.
+//    Called concurrently from the writeSmpl worker threads,
+//    so it must only touch the samples it is given.
+//---------------------------------------------------------
+
+bool SoundFont::compressSample(const Sample *s, const Sample *right, uint64_t key,
+                               double quality, OggSink &sink) {
+    std::span<const int16_t> ibuffer = sampleData.view(s->start, s->end);
+    std::span<const int16_t> rbuffer;
+    if (right)
+        rbuffer = sampleData.view(right->start, right->end);
+    int channels = right ? 2 : 1;
+    int samples = ibuffer.size();
 
     ogg_stream_state os;
     ogg_page og;
@@ -960,18 +1974,19 @@ int SoundFont::writeCompressedSample(Sample *s) {
     vorbis_comment vc;
 
     vorbis_info_init(&vi);
-    int ret = vorbis_encode_init_vbr(&vi, 1, s->samplerate, _oggQuality);
+    int ret = vorbis_encode_init_vbr(&vi, channels, s->samplerate, quality);
     if (ret) {
-        printf("vorbis init failed\n");
+        vorbis_info_clear(&vi);
         return false;
     }
     vorbis_comment_init(&vc);
+    char keyText[17];
+    snprintf(keyText, sizeof(keyText), "%016llx", (unsigned long long)key);
+    vorbis_comment_add_tag(&vc, streamKeyTag, keyText);
     vorbis_analysis_init(&vd, &vi);
     vorbis_block_init(&vd, &vb);
 
-    srand(time(NULL));
-    const int oggSerial = rand();
-    ogg_stream_init(&os, oggSerial);
+    ogg_stream_init(&os, key & 0x7fffffff);
 
     ogg_packet header;
     ogg_packet header_comm;
@@ -982,33 +1997,24 @@ int SoundFont::writeCompressedSample(Sample *s) {
     ogg_stream_packetin(&os, &header_comm);
     ogg_stream_packetin(&os, &header_code);
 
-    char obuf[1024 * 1024];
-    char *p = obuf;
-
     for (;;) {
         int result = ogg_stream_flush(&os, &og);
         if (result == 0)
             break;
-        memcpy(p, og.header, og.header_len);
-        p += og.header_len;
-        memcpy(p, og.body, og.body_len);
-        p += og.body_len;
+        writePage(sink, og);
     }
 
-    long i;
-    int page = 0;
-    double linearAmp = pow(10.0, _oggAmp / 20.0);
-    for (;;) {
-        int bufflength = std::min(BLOCK_SIZE, samples - page * BLOCK_SIZE);
-        float **buffer = vorbis_analysis_buffer(&vd, bufflength);
-        int j = 0;
-        int max = std::min((page + 1) * BLOCK_SIZE, samples);
-        for (i = page * BLOCK_SIZE; i < max; i++) {
-            buffer[0][j] = (ibuffer[i] / 32768.f) * linearAmp;
-            j++;
-        }
-
-        vorbis_analysis_wrote(&vd, bufflength);
+    // Fed in blocks of options.blockSize frames, converted and
+    // scaled straight into the analysis buffer
+    float gain = pow(10.0, options.oggAmp / 20.0) / 32768.0;
+    int blockSize = std::max(1, options.blockSize);
+    for (int pos = 0; pos < samples; pos += blockSize) {
+        int n = std::min(blockSize, samples - pos);
+        float **buffer = vorbis_analysis_buffer(&vd, n);
+        pcmToFloat(ibuffer.data() + pos, buffer[0], n, gain);
+        if (right)
+            pcmToFloat(rbuffer.data() + pos, buffer[1], n, gain);
+        vorbis_analysis_wrote(&vd, n);
 
         while (vorbis_analysis_blockout(&vd, &vb) == 1) {
             vorbis_analysis(&vb, 0);
@@ -1021,16 +2027,10 @@ int SoundFont::writeCompressedSample(Sample *s) {
                     int result = ogg_stream_pageout(&os, &og);
                     if (result == 0)
                         break;
-                    memcpy(p, og.header, og.header_len);
-                    p += og.header_len;
-                    memcpy(p, og.body, og.body_len);
-                    p += og.body_len;
+                    writePage(sink, og);
                 }
             }
         }
-        page++;
-        if ((max == samples) || !((samples - page * BLOCK_SIZE) > 0))
-            break;
     }
 
     vorbis_analysis_wrote(&vd, 0);
@@ -1046,10 +2046,7 @@ int SoundFont::writeCompressedSample(Sample *s) {
                 int result = ogg_stream_pageout(&os, &og);
                 if (result == 0)
                     break;
-                memcpy(p, og.header, og.header_len);
-                p += og.header_len;
-                memcpy(p, og.body, og.body_len);
-                p += og.body_len;
+                writePage(sink, og);
             }
         }
     }
@@ -1060,98 +2057,236 @@ int SoundFont::writeCompressedSample(Sample *s) {
     vorbis_comment_clear(&vc);
     vorbis_info_clear(&vi);
 
-    int n = p - obuf;
-    write(obuf, n);
-
-    return n;
+    return true;
 }
 
 //---------------------------------------------------------
-//   checkInstrument
+//   markReferences
+//    Flag every index the generator gen of a kept item
+//    points at
 //---------------------------------------------------------
 
-static bool checkInstrument(std::vector<int> pnums, std::vector<Preset *> presets, int instrIdx) {
-    for (int idx : pnums) {
-        Preset *p = presets[idx];
-        for (Zone *z : p->zones) {
-            for (GeneratorList *g : z->generators) {
-                if (g->gen == Gen_Instrument) {
-                    if (instrIdx == g->amount.uword)
-                        return true;
-                }
+template <class Item>
+static void markReferences(const std::vector<Item> &items, const std::vector<bool> &keep,
+                           const ZoneList &zones, Generator gen, std::vector<bool> *used) {
+    for (size_t i = 0; i < items.size(); ++i) {
+        if (!keep[i])
+            continue;
+        for (const Zone &z : zones.zonesOf(items[i].zoneIndex, items[i].zoneCount)) {
+            for (const GeneratorList &g : zones.generatorsOf(z)) {
+                if (g.gen == gen && g.amount.uword < used->size())
+                    (*used)[g.amount.uword] = true;
             }
         }
     }
-    return false;
 }
 
-static bool checkInstrument(std::vector<Preset *> presets, int instrIdx) {
-    bool result = false;
-    for (int i = 0; i < presets.size(); i++) {
-        Preset *p = presets[i];
-        Zone *z = p->zones[0];
-        for (GeneratorList *g : z->generators) {
-            if (g->gen == Gen_Instrument) {
-                if (instrIdx == g->amount.uword)
-                    return true;
+//---------------------------------------------------------
+//   compactZones
+//    Drop the items not kept together with their zones, and
+//    renumber the references of generator gen through remap
+//---------------------------------------------------------
+
+template <class Item>
+static ZoneList compactZones(std::vector<Item> *items, const std::vector<bool> &keep,
+                             const ZoneList &zones, Generator gen, const std::vector<int> &remap) {
+    ZoneList compacted;
+    std::vector<Item> kept;
+    for (size_t i = 0; i < items->size(); ++i) {
+        if (!keep[i])
+            continue;
+        Item item = (*items)[i];
+        item.zoneIndex = compacted.zones.size();
+        for (const Zone &z : zones.zonesOf((*items)[i].zoneIndex, (*items)[i].zoneCount)) {
+            Zone zone = z;
+            zone.genIndex = compacted.generators.size();
+            zone.modIndex = compacted.modulators.size();
+            for (GeneratorList g : zones.generatorsOf(z)) {
+                if (g.gen == gen && g.amount.uword < remap.size())
+                    g.amount.uword = remap[g.amount.uword];
+                compacted.generators.push_back(g);
             }
+            for (const ModulatorList &m : zones.modulatorsOf(z))
+                compacted.modulators.push_back(m);
+            compacted.zones.push_back(zone);
         }
+        kept.push_back(item);
     }
-    return false;
+    *items = std::move(kept);
+    return compacted;
 }
 
 //---------------------------------------------------------
-//   checkSample
+//   remapIndices
+//    Old index to new index for the kept entries
 //---------------------------------------------------------
 
-static bool checkSample(std::vector<int> pnums, std::vector<Preset *> presets,
-                        std::vector<Instrument *> instruments, int sampleIdx) {
+static std::vector<int> remapIndices(const std::vector<bool> &keep) {
+    std::vector<int> remap(keep.size(), -1);
     int idx = 0;
-    for (Instrument *instrument : instruments) {
-        if (!checkInstrument(pnums, presets, idx)) {
-            ++idx;
-            continue;
-        }
-        int zones = instrument->zones.size();
-        for (Zone *z : instrument->zones) {
-            std::vector<GeneratorList *> gl;
-            for (GeneratorList *g : z->generators) {
-                if (g->gen == Gen_SampleId) {
-                    if (sampleIdx == g->amount.uword)
-                        return true;
-                }
-            }
-        }
-        ++idx;
+    for (size_t i = 0; i < keep.size(); ++i) {
+        if (keep[i])
+            remap[i] = idx++;
     }
-    return false;
+    return remap;
 }
 
 //---------------------------------------------------------
-//   checkSample
+//   linkedSample
+//    The sample a right, left or linked sample points at
 //---------------------------------------------------------
 
-static bool checkSample(std::vector<Preset *> presets, std::vector<Instrument *> instruments,
-                        int sampleIdx) {
-    int idx = 0;
-    for (Instrument *instrument : instruments) {
-        if (!checkInstrument(presets, idx)) {
-            ++idx;
-            continue;
+static int linkedSample(const std::vector<Sample> &samples, int idx) {
+    const Sample &s = samples[idx];
+    if (!(s.sampletype & (2 | 4 | 8)) || s.sampletype & 0x8000)
+        return -1;
+    if (s.sampleLink < 0 || s.sampleLink >= (int)samples.size() || s.sampleLink == idx)
+        return -1;
+    return s.sampleLink;
+}
+
+//---------------------------------------------------------
+//   keepReachable
+//    Keep the flagged presets and only the instruments and
+//    samples they reach. Linked partners of a kept sample are
+//    kept with it; a sample whose link points at no sample is
+//    written as mono.
+//---------------------------------------------------------
+
+void SoundFont::keepReachable(const std::vector<bool> &keepPreset) {
+    std::vector<bool> keepInstrument(instruments.size(), false);
+    markReferences(presets, keepPreset, pZones, Gen_Instrument, &keepInstrument);
+    std::vector<bool> keepSample(samples.size(), false);
+    markReferences(instruments, keepInstrument, iZones, Gen_SampleId, &keepSample);
+    // A kept sample keeps its link partner, and that partner its own
+    std::vector<int> pending;
+    for (size_t i = 0; i < samples.size(); ++i) {
+        if (keepSample[i])
+            pending.push_back(i);
+    }
+    while (!pending.empty()) {
+        int link = linkedSample(samples, pending.back());
+        pending.pop_back();
+        if (link >= 0 && !keepSample[link]) {
+            keepSample[link] = true;
+            pending.push_back(link);
         }
-        int zones = instrument->zones.size();
-        for (Zone *z : instrument->zones) {
-            std::vector<GeneratorList *> gl;
-            for (GeneratorList *g : z->generators) {
-                if (g->gen == Gen_SampleId) {
-                    if (sampleIdx == g->amount.uword)
-                        return true;
-                }
-            }
+    }
+
+    std::vector<int> instrumentIdx = remapIndices(keepInstrument);
+    std::vector<int> sampleIdx = remapIndices(keepSample);
+    pZones = compactZones(&presets, keepPreset, pZones, Gen_Instrument, instrumentIdx);
+    iZones = compactZones(&instruments, keepInstrument, iZones, Gen_SampleId, sampleIdx);
+
+    std::vector<Sample> kept;
+    for (size_t i = 0; i < samples.size(); ++i) {
+        if (!keepSample[i])
+            continue;
+        Sample s = samples[i];
+        int link = linkedSample(samples, i);
+        if (link >= 0 && sampleIdx[link] >= 0)
+            s.sampleLink = sampleIdx[link];
+        else if (!(s.sampletype & 0x8000)) {
+            // Without its partner the sample plays as mono
+            if (s.sampletype & (2 | 4 | 8))
+                s.sampletype = (s.sampletype & ~(2 | 4 | 8)) | 1;
+            s.sampleLink = 0;
         }
-        ++idx;
+        kept.push_back(s);
     }
-    return false;
+    samples = std::move(kept);
+}
+
+//---------------------------------------------------------
+//   extract
+//    Reduce the font to the given presets
+//---------------------------------------------------------
+
+void SoundFont::extract(const std::vector<int> &presetIdx) {
+    std::vector<bool> keepPreset(presets.size(), false);
+    for (int idx : presetIdx) {
+        if (idx < 0 || idx >= (int)presets.size())
+            throw std::string("preset index out of range");
+        keepPreset[idx] = true;
+    }
+    keepReachable(keepPreset);
+}
+
+//---------------------------------------------------------
+//   prune
+//    Drop the instruments and samples no preset reaches
+//---------------------------------------------------------
+
+void SoundFont::prune() {
+    int instrumentCount = instruments.size();
+    int sampleCount = samples.size();
+    keepReachable(std::vector<bool>(presets.size(), true));
+    printf("Pruned %d unused instruments and %d unused samples\n",
+           instrumentCount - (int)instruments.size(), sampleCount - (int)samples.size());
+}
+
+//---------------------------------------------------------
+//   findPreset
+//---------------------------------------------------------
+
+int SoundFont::findPreset(int bank, int program) const {
+    for (size_t i = 0; i < presets.size(); ++i) {
+        if (presets[i].bank == bank && presets[i].preset == program)
+            return i;
+    }
+    return -1;
+}
+
+//---------------------------------------------------------
+//   infoStrings
+//    The INFO strings present, by key
+//---------------------------------------------------------
+
+std::vector<std::pair<const char *, const char *>> SoundFont::infoStrings() const {
+    std::vector<std::pair<const char *, const char *>> fields = {
+        {"name", name},   {"engine", engine}, {"product", product}, {"creator", creator},
+        {"tools", tools}, {"date", date},     {"comment", comment}, {"copyright", copyright}};
+    std::erase_if(fields, [](const auto &field) { return field.second == nullptr; });
+    return fields;
+}
+
+//---------------------------------------------------------
+//   dumpInfo
+//    The version and the INFO strings
+//---------------------------------------------------------
+
+void SoundFont::dumpInfo() {
+    printf("version: %d.%d\n", version.major, version.minor);
+    for (auto [key, value] : infoStrings())
+        printf("%s: %s\n", key, value);
+}
+
+//---------------------------------------------------------
+//   dumpPresetsJson
+//    One line of JSON: the file, with info its version and
+//    INFO strings, and index, bank, program and name of
+//    every preset
+//---------------------------------------------------------
+
+void SoundFont::dumpPresetsJson(bool info) {
+    std::string line = "{\"file\":" + jsonString(path);
+    if (info) {
+        line += ",\"version\":\"" + std::to_string(version.major) + "." +
+                std::to_string(version.minor) + "\"";
+        for (auto [key, value] : infoStrings())
+            line += ",\"" + std::string(key) + "\":" + jsonString(value);
+    }
+    line += ",\"presets\":[";
+    for (size_t i = 0; i < presets.size(); ++i) {
+        const Preset &p = presets[i];
+        if (i)
+            line += ",";
+        line += "{\"index\":" + std::to_string(i) + ",\"bank\":" + std::to_string(p.bank) +
+                ",\"program\":" + std::to_string(p.preset) + ",\"name\":" + jsonString(p.name) +
+                "}";
+    }
+    line += "]}";
+    printf("%s\n", line.c_str());
 }
 
 //---------------------------------------------------------
@@ -1160,8 +2295,8 @@ static bool checkSample(std::vector<Preset *> presets, std::vector<Instrument *>
 
 void SoundFont::dumpPresets() {
     int idx = 0;
-    for (const Preset *p : presets) {
-        printf("%03d %04x-%02x %s\n", idx, p->bank, p->preset, p->name);
+    for (const Preset &p : presets) {
+        printf("%03d %04x-%02x %s\n", idx, p.bank, p.preset, p.name);
         ++idx;
     }
 }
@@ -1,5 +1,14 @@
 #pragma once
+#include "decodecache.h"
+#include "oggsink.h"
+#include "riffindex.h"
+#include "riffwriter.h"
+#include "sampledata.h"
+
 #include <fstream>
+#include <functional>
+#include <memory>
+#include <span>
 #include <vector>
 
 //---------------------------------------------------------
@@ -108,12 +117,48 @@ struct GeneratorList {
 
 //---------------------------------------------------------
 //   Zone
+//    A bag: index ranges into the generators and modulators
+//    of the ZoneList that owns it
 //---------------------------------------------------------
 
 struct Zone {
-    std::vector<GeneratorList *> generators;
-    std::vector<ModulatorList *> modulators;
-    int instrumentIndex;
+    int genIndex{0};
+    int genCount{0};
+    int modIndex{0};
+    int modCount{0};
+};
+
+//---------------------------------------------------------
+//   ZoneList
+//    Zones, generators and modulators of the preset or the
+//    instrument level, each stored contiguously in file order
+//---------------------------------------------------------
+
+struct ZoneList {
+    std::vector<Zone> zones;
+    std::vector<GeneratorList> generators;
+    std::vector<ModulatorList> modulators;
+
+    std::span<const Zone> zonesOf(int zoneIndex, int zoneCount) const {
+        return std::span<const Zone>(zones).subspan(zoneIndex, zoneCount);
+    }
+    std::span<const GeneratorList> generatorsOf(const Zone &z) const {
+        return std::span<const GeneratorList>(generators).subspan(z.genIndex, z.genCount);
+    }
+    std::span<const ModulatorList> modulatorsOf(const Zone &z) const {
+        return std::span<const ModulatorList>(modulators).subspan(z.modIndex, z.modCount);
+    }
+};
+
+//---------------------------------------------------------
+//   RawChunk
+//    A chunk carried over unchanged, like an INFO sub-chunk
+//    that is not interpreted here
+//---------------------------------------------------------
+
+struct RawChunk {
+    char id[4];
+    std::vector<unsigned char> data;
 };
 
 //---------------------------------------------------------
@@ -121,14 +166,14 @@ struct Zone {
 //---------------------------------------------------------
 
 struct Preset {
-    char *name{0};
+    char name[21]{};
     int preset{0};
     int bank{0};
-    int presetBagNdx{0}; // used only for read
     int library{0};
     int genre{0};
     int morphology{0};
-    std::vector<Zone *> zones;
+    int zoneIndex{0}; // first zone in the preset ZoneList
+    int zoneCount{0};
 };
 
 //---------------------------------------------------------
@@ -136,12 +181,9 @@ struct Preset {
 //---------------------------------------------------------
 
 struct Instrument {
-    char *name;
-    int index; // used only for read
-    std::vector<Zone *> zones;
-
-    Instrument();
-    ~Instrument();
+    char name[21]{};
+    int zoneIndex{0}; // first zone in the instrument ZoneList
+    int zoneCount{0};
 };
 
 //---------------------------------------------------------
@@ -149,19 +191,71 @@ struct Instrument {
 //---------------------------------------------------------
 
 struct Sample {
-    char *name;
-    unsigned int start;
-    unsigned int end;
-    unsigned int loopstart;
-    unsigned int loopend;
-    unsigned int samplerate;
-
-    int origpitch;
-    int pitchadj;
-    int sampletype;
-
-    Sample();
-    ~Sample();
+    char name[21]{};
+    unsigned int start{0};
+    unsigned int end{0};
+    unsigned int loopstart{0};
+    unsigned int loopend{0};
+    unsigned int samplerate{0};
+
+    int origpitch{0};
+    int pitchadj{0};
+    int sampleLink{0};
+    int sampletype{0};
+};
+
+//---------------------------------------------------------
+//   SamplePcm
+//    PCM of one sample. For a compressed font it holds the
+//    decoded stream, so the data stays valid after the
+//    decode cache drops it.
+//---------------------------------------------------------
+
+struct SamplePcm {
+    std::span<const int16_t> pcm;
+    std::shared_ptr<const DecodedStream> stream;
+};
+
+//---------------------------------------------------------
+//   WriteOptions
+//---------------------------------------------------------
+
+class OutputFile;
+class PreviousFont;
+class SampleCache;
+class Stats;
+struct QualityTrial;
+
+struct WriteOptions {
+    double oggQuality{0};
+    double targetSnr{0};  // dB, choose each sample's quality to meet it
+    size_t targetSize{0}; // bytes, choose sample qualities to fit the file in it
+    double oggAmp{0};     // dB
+    int jobs{1};          // encoding threads, 0 for one per core
+    int blockSize{1024};  // frames handed to the Vorbis analysis at a time
+    size_t maxMemory{0};  // bytes of PCM and encoded data in flight, 0 for no limit
+    bool jointStereo{false};
+    bool dedupe{true};           // encode identical sample data once
+    bool prune{false};           // drop instruments and samples no preset uses
+    bool streaming{false};       // output cannot seek, encode every sample first
+    SampleCache *cache{nullptr}; // reuse earlier encodes of the same sample
+    PreviousFont *update{nullptr}; // copy unchanged streams from an earlier output
+};
+
+//---------------------------------------------------------
+//   OggStream
+//    One compressed stream of the smpl chunk
+//---------------------------------------------------------
+
+struct OggStream {
+    int sample{0};        // mono or left sample
+    int right{-1};        // linked right sample with joint stereo
+    uint64_t dataHash{0}; // sample data and rate
+    uint64_t key{0};      // dataHash with the encoder settings, see streamKey
+    double quality{0};
+    int duplicateOf{-1};  // earlier stream with identical data
+    bool encoded{false};  // data encoded ahead of writing
+    OggChunks data;
 };
 
 //---------------------------------------------------------
@@ -179,42 +273,44 @@ class SoundFont {
     char *creator;
     char *product;
     char *copyright;
+    std::vector<RawChunk> infoChunks; // other INFO sub-chunks, like irom and iver
 
-    int samplePos;
-    int sampleLen;
+    RiffIndex riff;
+    size_t samplePos;
+    size_t sampleLen;
+    SampleData sampleData;
 
-    std::vector<Preset *> presets;
-    std::vector<Instrument *> instruments;
+    std::vector<Preset> presets;
+    std::vector<Instrument> instruments;
 
-    std::vector<Zone *> pZones;
-    std::vector<Zone *> iZones;
-    std::vector<Sample *> samples;
+    ZoneList pZones;
+    ZoneList iZones;
+    std::vector<Sample> samples;
+    std::vector<OggStream> streams;
+    bool writeCompressed{true};
+
+    // PCM of a compressed font, one vector per decoded channel,
+    // and the channel each sample is written from
+    std::vector<std::vector<int16_t>> decodedPcm;
+    std::vector<int> samplePcm;
+    std::unique_ptr<DecodeCache> decodeCache;
+    Stats *stats{nullptr};
 
     std::fstream *file;
-    FILE *f;
-
-    double _oggQuality;
-    double _oggAmp;
-
-    unsigned readDword();
-    int readWord();
-    int readShort();
-    int readByte();
-    int readChar();
-    int readFourcc(const char *);
-    int readFourcc(char *);
-    void readSignature(const char *signature);
-    void readSignature(char *signature);
-    void skip(int);
-    void readSection(const char *fourcc, int len);
+    RiffWriter *out{nullptr};
+
+    WriteOptions options;
+
+    bool readSection(const char *fourcc, uint32_t len);
     void readVersion();
-    char *readString(int);
-    void readPhdr(int);
-    void readBag(int, std::vector<Zone *> *);
-    void readMod(int, std::vector<Zone *> *);
-    void readGen(int, std::vector<Zone *> *);
-    void readInst(int);
-    void readShdr(int);
+    char *readString(uint32_t);
+    std::vector<unsigned char> readChunk(uint32_t len);
+    void readPhdr(const std::vector<unsigned char> &);
+    void readBag(const std::vector<unsigned char> &, ZoneList *);
+    void readMod(const std::vector<unsigned char> &, ZoneList *);
+    void readGen(const std::vector<unsigned char> &, ZoneList *);
+    void readInst(const std::vector<unsigned char> &);
+    void readShdr(const std::vector<unsigned char> &);
 
     void writeDword(int);
     void writeWord(unsigned short int);
@@ -225,26 +321,87 @@ class SoundFont {
     bool writeSampleFile(Sample *, std::string);
     void writeSample(const Sample *);
     void writeStringSection(const char *fourcc, char *s);
+    std::vector<std::pair<const char *, const char *>> infoStrings() const;
     void writePreset(int zoneIdx, const Preset *);
     void writeModulator(const ModulatorList *);
     void writeGenerator(const GeneratorList *);
     void writeInstrument(int zoneIdx, const Instrument *);
 
     void writeIfil();
+    void writeInfo();
     void writeSmpl();
     void writePhdr();
-    void writeBag(const char *fourcc, std::vector<Zone *> *);
-    void writeMod(const char *fourcc, const std::vector<Zone *> *);
-    void writeGen(const char *fourcc, std::vector<Zone *> *);
+    void writeBag(const char *fourcc, const ZoneList *);
+    void writeMod(const char *fourcc, const ZoneList *);
+    void writeGen(const char *fourcc, const ZoneList *);
     void writeInst();
     void writeShdr();
-
-    int writeCompressedSample(Sample *);
+    void writePdta();
+    std::string infoChunk();
+    std::string pdtaChunk();
+    void writeHeaders(const std::string &info, unsigned smplLen, size_t pdtaLen);
+    void writeStreamed();
+    void writePositional(OutputFile *);
+    unsigned placeStreams(const std::vector<size_t> &lengths);
+    void placeStream(const OggStream &, unsigned start, unsigned end);
+    void reportDuplicates() const;
+
+    int stereoPartner(int sampleIdx) const;
+    uint64_t streamHash(const OggStream &) const;
+    uint64_t streamKey(const OggStream &, double quality) const;
+    bool sameStreamData(const OggStream &, const OggStream &) const;
+    void dedupeStreams();
+    void keepReachable(const std::vector<bool> &keepPreset);
+    bool compressSample(const Sample *, const Sample *right, uint64_t key, double quality,
+                        OggSink &);
+    bool compressStream(const OggStream &, OggSink &);
+    std::string cacheKey(const OggStream &) const;
+    bool encodeOrLoad(const OggStream &, OggSink &, bool *cached);
+    void releasePcm(const OggStream &);
+    void encodeStreams(const std::function<void(int)> &place, const std::function<void(int)> &emit);
+    void decodeSamples(int jobs);
+    QualityTrial trialEncode(const OggStream &, double quality, OggChunks *data);
+    void searchQualities();
+
+    friend struct SoundFontBench; // times the private write steps
 
   public:
     SoundFont(const std::string &);
+    SoundFont(const SoundFont &) = delete;
+    SoundFont &operator=(const SoundFont &) = delete;
     ~SoundFont();
+    void setStats(Stats *s) { stats = s; } // record timings of read and write
     bool read();
-    bool write(std::fstream *, double oggQuality, double oggAmp);
+    bool readMetadata(bool info);
+    const RiffIndex &chunks() const { return riff; } // after read()
+    bool write(std::ostream *, const WriteOptions &);
+    bool write(OutputFile *, const WriteOptions &);
+
+    // write() in steps, for callers scheduling the encoding themselves
+    bool prepare(const WriteOptions &);
+    int streamCount() const { return streams.size(); }
+    size_t streamFrames(int stream) const;
+    void encodeStream(int stream);
+    bool writePrepared(std::ostream *);
+    bool writePrepared(OutputFile *);
+
+    bool isCompressed() const;
+    bool decompress(std::ostream *, int jobs);
+
+    // Random access to single samples after read(). Compressed
+    // samples are decoded on first use and kept in an LRU cache
+    // of up to cacheBytes of PCM.
+    bool openSamples(size_t cacheBytes = 64 << 20);
+    const Sample &sample(int idx) const { return samples[idx]; }
+    SamplePcm loadSample(int idx);
+    std::span<const char> sampleStream(int idx) const;
+
+    int presetCount() const { return presets.size(); }
+    int findPreset(int bank, int program) const;
+    void extract(const std::vector<int> &presetIdx);
+    void prune();
+    int sampleCount() const { return samples.size(); }
     void dumpPresets();
+    void dumpInfo();
+    void dumpPresetsJson(bool info);
 };
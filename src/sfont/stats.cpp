@@ -0,0 +1,150 @@
+#include "stats.h"
+
+#include <cstdio>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+//---------------------------------------------------------
+//   addPhase
+//---------------------------------------------------------
+
+void Stats::addPhase(const std::string &name, double wall, double cpu) {
+    std::lock_guard<std::mutex> lock(mutex);
+    phases.push_back({name, wall, cpu});
+}
+
+//---------------------------------------------------------
+//   addSample
+//---------------------------------------------------------
+
+void Stats::addSample(const Sample &s) {
+    std::lock_guard<std::mutex> lock(mutex);
+    samples.push_back(s);
+}
+
+//---------------------------------------------------------
+//   cpuTime
+//    User and system time of the whole process
+//---------------------------------------------------------
+
+double Stats::cpuTime() {
+#ifdef _WIN32
+    FILETIME create, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &create, &exit, &kernel, &user))
+        return 0;
+    auto seconds = [](const FILETIME &t) {
+        return (((unsigned long long)t.dwHighDateTime << 32) | t.dwLowDateTime) * 1e-7;
+    };
+    return seconds(kernel) + seconds(user);
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage))
+        return 0;
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 + usage.ru_stime.tv_sec +
+           usage.ru_stime.tv_usec * 1e-6;
+#endif
+}
+
+//---------------------------------------------------------
+//   peakRss
+//    Peak resident set size in bytes
+//---------------------------------------------------------
+
+size_t Stats::peakRss() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return counters.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage))
+        return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss; // bytes
+#else
+    return (size_t)usage.ru_maxrss * 1024; // KiB
+#endif
+#endif
+}
+
+//---------------------------------------------------------
+//   jsonString
+//---------------------------------------------------------
+
+std::string jsonString(const std::string &s) {
+    std::string out = "\"";
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c < 0x20) {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            out += escape;
+        } else
+            out += c;
+    }
+    return out + "\"";
+}
+
+//---------------------------------------------------------
+//   write
+//    JSON report. The ratio is compressed bytes over the
+//    bytes of 16 bit PCM.
+//---------------------------------------------------------
+
+bool Stats::write(const std::string &path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    FILE *f = fopen(path.c_str(), "w");
+    if (!f) {
+        fprintf(stderr, "cannot write stats to <%s>\n", path.c_str());
+        return false;
+    }
+    fprintf(f, "{\n  \"phases\": [");
+    for (size_t i = 0; i < phases.size(); ++i) {
+        const Phase &p = phases[i];
+        fprintf(f, "%s\n    {\"name\": %s, \"wall\": %.6f, \"cpu\": %.6f}", i ? "," : "",
+                jsonString(p.name).c_str(), p.wall, p.cpu);
+    }
+    fprintf(f, "\n  ],\n  \"samples\": [");
+    for (size_t i = 0; i < samples.size(); ++i) {
+        const Sample &s = samples[i];
+        size_t pcmBytes = s.frames * s.channels * 2;
+        fprintf(f,
+                "%s\n    {\"name\": %s, \"frames\": %zu, \"channels\": %d, \"quality\": %.2f, "
+                "\"encodeTime\": %.6f, \"bytes\": %zu, \"ratio\": %.4f, \"cached\": %s}",
+                i ? "," : "", jsonString(s.name).c_str(), s.frames, s.channels, s.quality,
+                s.encodeTime, s.bytes, pcmBytes ? (double)s.bytes / pcmBytes : 0.0,
+                s.cached ? "true" : "false");
+    }
+    fprintf(f, "\n  ],\n  \"peakRss\": %zu\n}\n", peakRss());
+    bool ok = !ferror(f);
+    fclose(f);
+    return ok;
+}
+
+//---------------------------------------------------------
+//   PhaseTimer
+//---------------------------------------------------------
+
+PhaseTimer::PhaseTimer(Stats *s, const std::string &n) : stats(s) {
+    if (!stats)
+        return;
+    name = n;
+    wallStart = std::chrono::steady_clock::now();
+    cpuStart = Stats::cpuTime();
+}
+
+PhaseTimer::~PhaseTimer() {
+    if (!stats)
+        return;
+    std::chrono::duration<double> wall = std::chrono::steady_clock::now() - wallStart;
+    stats->addPhase(name, wall.count(), Stats::cpuTime() - cpuStart);
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//---------------------------------------------------------
+//   Stats
+//    Timings of a read or write, for --stats. Phases record
+//    wall and process CPU time; every encoded stream records
+//    its size and encode time. Samples may be added from
+//    several encoder threads.
+//---------------------------------------------------------
+
+class Stats {
+  public:
+    struct Phase {
+        std::string name;
+        double wall; // seconds
+        double cpu;  // seconds, all threads
+    };
+    struct Sample {
+        std::string name;
+        size_t frames;
+        int channels;
+        double quality;
+        double encodeTime; // seconds
+        size_t bytes;
+        bool cached;
+    };
+
+  private:
+    std::mutex mutex;
+    std::vector<Phase> phases;
+    std::vector<Sample> samples;
+
+  public:
+    void addPhase(const std::string &name, double wall, double cpu);
+    void addSample(const Sample &);
+    bool write(const std::string &path);
+
+    static double cpuTime();
+    static size_t peakRss();
+};
+
+//---------------------------------------------------------
+//   PhaseTimer
+//    Adds the time from construction to destruction as one
+//    phase. Does nothing without a Stats.
+//---------------------------------------------------------
+
+class PhaseTimer {
+    Stats *stats;
+    std::string name;
+    std::chrono::steady_clock::time_point wallStart;
+    double cpuStart{0};
+
+  public:
+    PhaseTimer(Stats *, const std::string &name);
+    PhaseTimer(const PhaseTimer &) = delete;
+    PhaseTimer &operator=(const PhaseTimer &) = delete;
+    ~PhaseTimer();
+};
+
+//---------------------------------------------------------
+//   jsonString
+//    s quoted and escaped as a JSON string
+//---------------------------------------------------------
+
+std::string jsonString(const std::string &s);
@@ -0,0 +1,116 @@
+#include "taskpool.h"
+
+//---------------------------------------------------------
+//   TaskPool
+//---------------------------------------------------------
+
+TaskPool::TaskPool(int n) {
+    if (n < 1)
+        n = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 0; i < n; ++i)
+        queues.push_back(std::make_unique<Queue>());
+    for (int i = 0; i < n; ++i)
+        threads.emplace_back(&TaskPool::run, this, i);
+}
+
+TaskPool::~TaskPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &t : threads)
+        t.join();
+}
+
+//---------------------------------------------------------
+//   submit
+//    Tasks are dealt round robin over the worker queues.
+//    Running tasks may submit more.
+//---------------------------------------------------------
+
+void TaskPool::submit(std::function<void()> task) {
+    size_t idx;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        idx = nextQueue;
+        nextQueue = (nextQueue + 1) % queues.size();
+    }
+    Queue &q = *queues[idx];
+    {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        q.tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++queued;
+        ++pending;
+    }
+    wake.notify_one();
+}
+
+//---------------------------------------------------------
+//   wait
+//    Block until every submitted task has finished. The first
+//    exception thrown by a task is rethrown here.
+//---------------------------------------------------------
+
+void TaskPool::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this] { return pending == 0; });
+    if (error) {
+        std::exception_ptr e = error;
+        error = nullptr;
+        std::rethrow_exception(e);
+    }
+}
+
+//---------------------------------------------------------
+//   pop
+//    Next task from the worker's own queue, else stolen
+//    from another queue. Only called after reserving one of
+//    the queued tasks, so a task is always found.
+//---------------------------------------------------------
+
+bool TaskPool::pop(size_t worker, std::function<void()> &task) {
+    for (size_t i = 0; i < queues.size(); ++i) {
+        Queue &q = *queues[(worker + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (!q.tasks.empty()) {
+            task = std::move(q.tasks.front());
+            q.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+//---------------------------------------------------------
+//   run
+//---------------------------------------------------------
+
+void TaskPool::run(size_t worker) {
+    std::function<void()> task;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stopping || queued > 0; });
+            if (queued == 0)
+                return;
+            --queued;
+        }
+        if (!pop(worker, task))
+            continue;
+        try {
+            task();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error)
+                error = std::current_exception();
+        }
+        task = nullptr;
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--pending == 0)
+            idle.notify_all();
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//---------------------------------------------------------
+//   TaskPool
+//    Work-stealing thread pool. Every worker owns a queue
+//    and takes tasks from its front; a worker whose queue
+//    runs dry steals from the front of the others. Tasks
+//    submitted in order of decreasing cost are therefore
+//    started longest first across the whole pool.
+//---------------------------------------------------------
+
+class TaskPool {
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    size_t nextQueue{0}; // guarded by mutex
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    size_t queued{0};  // submitted but not yet taken by a worker
+    size_t pending{0}; // submitted but not yet finished
+    bool stopping{false};
+    std::exception_ptr error;
+
+    bool pop(size_t worker, std::function<void()> &task);
+    void run(size_t worker);
+
+  public:
+    TaskPool(int threads);
+    TaskPool(const TaskPool &) = delete;
+    TaskPool &operator=(const TaskPool &) = delete;
+    ~TaskPool();
+
+    int size() const { return threads.size(); }
+    void submit(std::function<void()> task);
+    void wait();
+};
@@ -0,0 +1,274 @@
+#include "verify.h"
+#include "parallel.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+//---------------------------------------------------------
+//   Verifier
+//---------------------------------------------------------
+
+Verifier::Verifier(const std::string &s, const std::string &o)
+    : sourcePath(s), outputPath(o), source(s), output(o) {}
+
+void Verifier::error(const std::string &s) { errors.push_back(s); }
+
+//---------------------------------------------------------
+//   checkStructure
+//    The chunks every SoundFont needs, and the same number
+//    of records in every pdta chunk as the source
+//---------------------------------------------------------
+
+void Verifier::checkStructure() {
+    static const struct {
+        const char *id;
+        uint32_t size;
+    } pdtaChunks[] = {{"phdr", 38}, {"pbag", 4},  {"pmod", 10}, {"pgen", 4}, {"inst", 22},
+                      {"ibag", 4},  {"imod", 10}, {"igen", 4},  {"shdr", 46}};
+
+    const RiffIndex &out = output.chunks();
+    const RiffIndex &in = source.chunks();
+    if (out.size() == 0 || memcmp(out[0].id, "sfbk", 4))
+        error("not a sfbk RIFF form");
+    for (const char *list : {"INFO", "sdta", "pdta"}) {
+        if (out.find(list) < 0)
+            error(std::string("missing LIST ") + list);
+    }
+    if (out.find("ifil", "INFO") < 0)
+        error("missing ifil chunk");
+    if (out.find("smpl", "sdta") < 0)
+        error("missing smpl chunk");
+    for (const auto &chunk : pdtaChunks) {
+        int idx = out.find(chunk.id, "pdta");
+        if (idx < 0) {
+            error(std::string("missing ") + chunk.id + " chunk");
+            continue;
+        }
+        uint32_t length = out[idx].length;
+        if (length % chunk.size) {
+            error(std::string(chunk.id) + " length " + std::to_string(length) +
+                  " is not a multiple of " + std::to_string(chunk.size));
+            continue;
+        }
+        int sourceIdx = in.find(chunk.id, "pdta");
+        uint32_t records = length / chunk.size;
+        uint32_t sourceRecords = sourceIdx < 0 ? 0 : in[sourceIdx].length / chunk.size;
+        if (records != sourceRecords)
+            error(std::string(chunk.id) + " has " + std::to_string(records) +
+                  " records, the source " + std::to_string(sourceRecords));
+    }
+    if (output.presetCount() != source.presetCount())
+        error("preset count differs from the source");
+    if (output.sampleCount() != source.sampleCount())
+        error("sample count differs from the source");
+}
+
+//---------------------------------------------------------
+//   checkSmpl
+//    Every byte of the smpl chunk of a compressed output
+//    belongs to some sample's stream. Unused bytes mean a
+//    stream was written that no sample header points at.
+//---------------------------------------------------------
+
+void Verifier::checkSmpl() {
+    int idx = output.chunks().find("smpl", "sdta");
+    if (idx < 0 || !output.isCompressed())
+        return;
+    std::vector<std::pair<unsigned, unsigned>> ranges;
+    for (int i = 0; i < output.sampleCount(); ++i) {
+        const Sample &s = output.sample(i);
+        if (s.sampletype & 0x10)
+            ranges.push_back({s.start, s.end});
+    }
+    std::sort(ranges.begin(), ranges.end());
+    uint64_t used = 0;
+    uint64_t covered = 0; // end of the ranges so far
+    for (const auto &[start, end] : ranges) {
+        if (end > covered) {
+            used += end - std::max<uint64_t>(start, covered);
+            covered = end;
+        }
+    }
+    uint32_t length = output.chunks()[idx].length;
+    if (used < length)
+        error(std::to_string(length - used) + " bytes of smpl data belong to no sample");
+}
+
+//---------------------------------------------------------
+//   checkSample
+//    Compare the header and PCM of sample idx in the output
+//    with the source. Error is measured like the quality
+//    search does: frames the decoder dropped count in full.
+//---------------------------------------------------------
+
+void Verifier::checkSample(int idx, SampleResult *r) {
+    const Sample &s = source.sample(idx);
+    const Sample &o = output.sample(idx);
+    r->name = s.name;
+    if (strcmp(s.name, o.name) || s.samplerate != o.samplerate || s.loopstart != o.loopstart ||
+        s.loopend != o.loopend || s.origpitch != o.origpitch || s.pitchadj != o.pitchadj ||
+        s.sampleLink != o.sampleLink || (s.sampletype & ~0x10) != (o.sampletype & ~0x10))
+        r->error = "sample header differs";
+    if (s.sampletype & 0x8000)
+        return; // ROM sample, no data
+
+    SamplePcm in;
+    SamplePcm out;
+    try {
+        in = source.loadSample(idx);
+        out = output.loadSample(idx);
+    } catch (const std::string &e) {
+        r->error = e;
+        return;
+    }
+    r->frames = in.pcm.size();
+    r->decodedFrames = out.pcm.size();
+
+    double linearAmp = pow(10.0, limits.amp / 20.0);
+    auto level = [&](size_t i) { return std::clamp(in.pcm[i] * linearAmp, -32768.0, 32767.0); };
+    size_t n = std::min(r->frames, r->decodedFrames);
+    double signal = 0;
+    double noise = 0;
+    double peak = 0;
+    for (size_t i = 0; i < r->frames; ++i) {
+        double v = level(i);
+        double e = i < n ? v - out.pcm[i] : v;
+        signal += v * v;
+        noise += e * e;
+        peak = std::max(peak, fabs(e));
+    }
+    r->snr = noise > 0 ? 10 * log10(signal / noise) : 200;
+    r->peakError = lround(peak);
+
+    // The step from the last frame of the loop back to its first
+    if (s.loopstart < s.loopend && s.loopend <= r->frames) {
+        size_t first = s.loopstart;
+        size_t last = s.loopend - 1;
+        r->loopJump = lround(fabs(level(last) - level(first)));
+        if (last < n)
+            r->decodedLoopJump = abs(out.pcm[last] - out.pcm[first]);
+    }
+
+    if (!r->error.empty())
+        return;
+    if (r->decodedFrames != r->frames)
+        r->error = "decoded " + std::to_string(r->decodedFrames) + " of " +
+                   std::to_string(r->frames) + " frames";
+    else if (limits.minSnr > 0 && r->snr < limits.minSnr)
+        r->error = "SNR below the minimum";
+    else if (limits.maxLoopJump > 0 && r->decodedLoopJump - r->loopJump > limits.maxLoopJump)
+        r->error = "loop jump above the maximum";
+}
+
+//---------------------------------------------------------
+//   run
+//    Returns true if everything was checked and passed
+//---------------------------------------------------------
+
+bool Verifier::run(int jobs, const Limits &l) {
+    auto start = std::chrono::steady_clock::now();
+    limits = l;
+    if (jobs <= 0)
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    if (!source.read() || !source.openSamples(0)) {
+        error("cannot read the source " + sourcePath);
+        return false;
+    }
+    // Keeps a decoded stereo stream until its other channel is checked
+    if (!output.read() || !output.openSamples(64 << 20)) {
+        error("cannot read the output");
+        return false;
+    }
+    checkStructure();
+    checkSmpl();
+    if (output.sampleCount() == source.sampleCount()) {
+        results.resize(source.sampleCount());
+        parallelFor(results.size(), jobs, [this](int i) { checkSample(i, &results[i]); });
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    seconds = elapsed.count();
+    return failures() == 0;
+}
+
+//---------------------------------------------------------
+//   failures
+//---------------------------------------------------------
+
+int Verifier::failures() const {
+    int n = errors.size();
+    for (const SampleResult &r : results)
+        n += !r.error.empty();
+    return n;
+}
+
+//---------------------------------------------------------
+//   report
+//    Failures one per line, then a summary
+//---------------------------------------------------------
+
+void Verifier::report() const {
+    for (const std::string &e : errors)
+        printf("%s: %s\n", outputPath.c_str(), e.c_str());
+    double minSnr = 200;
+    double sumSnr = 0;
+    int measured = 0;
+    int peakError = 0;
+    int worstLoop = 0;
+    for (const SampleResult &r : results) {
+        if (!r.error.empty())
+            printf("%s: sample <%s>: %s\n", outputPath.c_str(), r.name.c_str(), r.error.c_str());
+        if (!r.frames)
+            continue;
+        minSnr = std::min(minSnr, r.snr);
+        sumSnr += r.snr;
+        ++measured;
+        peakError = std::max(peakError, r.peakError);
+        if (r.loopJump >= 0 && r.decodedLoopJump >= 0)
+            worstLoop = std::max(worstLoop, r.decodedLoopJump - r.loopJump);
+    }
+    printf("Verified %d samples in %.2f s: SNR min %.1f dB, mean %.1f dB, peak error %d, "
+           "loop jump +%d\n",
+           (int)results.size(), seconds, measured ? minSnr : 0.0,
+           measured ? sumSnr / measured : 0.0, peakError, worstLoop);
+    if (failures())
+        printf("%s: failed (%d)\n", outputPath.c_str(), failures());
+    else
+        printf("%s: ok\n", outputPath.c_str());
+}
+
+//---------------------------------------------------------
+//   writeJson
+//---------------------------------------------------------
+
+bool Verifier::writeJson(const std::string &path) const {
+    FILE *f = fopen(path.c_str(), "w");
+    if (!f) {
+        fprintf(stderr, "cannot write report to <%s>\n", path.c_str());
+        return false;
+    }
+    fprintf(f, "{\n  \"source\": %s,\n  \"output\": %s,\n  \"ok\": %s,\n  \"seconds\": %.3f,\n",
+            jsonString(sourcePath).c_str(), jsonString(outputPath).c_str(),
+            failures() ? "false" : "true", seconds);
+    fprintf(f, "  \"errors\": [");
+    for (size_t i = 0; i < errors.size(); ++i)
+        fprintf(f, "%s\n    %s", i ? "," : "", jsonString(errors[i]).c_str());
+    fprintf(f, "\n  ],\n  \"samples\": [");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const SampleResult &r = results[i];
+        fprintf(f,
+                "%s\n    {\"name\": %s, \"frames\": %zu, \"decodedFrames\": %zu, \"snr\": %.2f, "
+                "\"peakError\": %d, \"loopJump\": %d, \"decodedLoopJump\": %d, \"error\": %s}",
+                i ? "," : "", jsonString(r.name).c_str(), r.frames, r.decodedFrames, r.snr,
+                r.peakError, r.loopJump, r.decodedLoopJump,
+                r.error.empty() ? "null" : jsonString(r.error).c_str());
+    }
+    fprintf(f, "\n  ]\n}\n");
+    bool ok = !ferror(f);
+    fclose(f);
+    return ok;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include "sfont.h"
+
+#include <string>
+#include <vector>
+
+//---------------------------------------------------------
+//   Verifier
+//    Round trip check of a converted SoundFont against its
+//    source: the RIFF structure and pdta record counts of
+//    the output, that no compressed data in smpl is left
+//    unused, every sample header, and the decoded PCM of
+//    every sample, which is compared with the source for
+//    signal to noise ratio, peak error and the jump at the
+//    loop point. Samples are decoded on a thread pool.
+//---------------------------------------------------------
+
+class Verifier {
+  public:
+    struct Limits {
+        double minSnr{0};   // dB, 0 for no limit
+        int maxLoopJump{0}; // added jump at the loop point, 0 for no limit
+        double amp{0};      // dB, the --amp the output was converted with
+    };
+    struct SampleResult {
+        std::string name;
+        size_t frames{0};
+        size_t decodedFrames{0};
+        double snr{0}; // dB
+        int peakError{0};
+        int loopJump{-1};        // |end - start| of the loop in the source, -1 without loop
+        int decodedLoopJump{-1}; // the same in the output
+        std::string error;
+    };
+
+  private:
+    std::string sourcePath;
+    std::string outputPath;
+    SoundFont source;
+    SoundFont output;
+    Limits limits;
+    std::vector<std::string> errors; // structure errors
+    std::vector<SampleResult> results;
+    double seconds{0};
+
+    void checkStructure();
+    void checkSmpl();
+    void checkSample(int idx, SampleResult *);
+    void error(const std::string &);
+
+  public:
+    Verifier(const std::string &source, const std::string &output);
+
+    bool run(int jobs, const Limits &);
+    int failures() const;
+    void report() const;
+    bool writeJson(const std::string &path) const;
+};
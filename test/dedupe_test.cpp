@@ -0,0 +1,122 @@
+#include "sfont/sfont.h"
+#include "testfont.h"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+//---------------------------------------------------------
+//   DedupeTest
+//    Two stereo pairs with the same data, the second listed
+//    right sample first, a third pair whose right channel
+//    differs, and two identical mono samples with the data
+//    of the left channels
+//---------------------------------------------------------
+
+class DedupeTest : public ::testing::Test {
+  protected:
+    fs::path source;
+    fs::path output;
+    std::unique_ptr<SoundFont> converted;
+
+    void SetUp() override {
+        std::string name = ::testing::UnitTest::GetInstance()->current_test_info()->name();
+        source = fs::temp_directory_path() / ("sftools-" + name + ".sf2");
+        output = fs::temp_directory_path() / ("sftools-" + name + ".sf3");
+        std::vector<int16_t> left = testTone(3000, 1);
+        std::vector<int16_t> right = testTone(3000, 2);
+        std::vector<int16_t> other = testTone(3000, 3);
+        ASSERT_TRUE(writeTestFont(source.string(), {{left, 1, 4},
+                                                    {right, 0, 2},
+                                                    {right, 3, 2},
+                                                    {left, 2, 4},
+                                                    {left, 0, 1},
+                                                    {left, 0, 1},
+                                                    {left, 7, 4},
+                                                    {other, 6, 2}}));
+    }
+    void TearDown() override {
+        converted.reset();
+        fs::remove(source);
+        fs::remove(output);
+    }
+
+    void convert(bool jointStereo, bool dedupe) {
+        SoundFont sf(source.string());
+        ASSERT_TRUE(sf.read());
+        WriteOptions options;
+        options.oggQuality = 0.3;
+        options.jointStereo = jointStereo;
+        options.dedupe = dedupe;
+        std::fstream out(output, std::fstream::out | std::fstream::binary);
+        ASSERT_TRUE(sf.write(&out, options));
+        out.close();
+        converted = std::make_unique<SoundFont>(output.string());
+        ASSERT_TRUE(converted->read());
+        ASSERT_EQ(converted->sampleCount(), 8);
+    }
+
+    // True if samples a and b point at the same stream
+    bool shared(int a, int b) {
+        const Sample &x = converted->sample(a);
+        const Sample &y = converted->sample(b);
+        return x.start == y.start && x.end == y.end;
+    }
+};
+
+TEST_F(DedupeTest, StereoPairsShareOneStream) {
+    ASSERT_NO_FATAL_FAILURE(convert(true, true));
+    EXPECT_TRUE(shared(0, 1));
+    EXPECT_TRUE(shared(2, 3));
+    EXPECT_TRUE(shared(0, 3)) << "the pair listed right first is a duplicate";
+    EXPECT_TRUE(shared(4, 5));
+    EXPECT_FALSE(shared(0, 4)) << "a mono stream is not a stereo one";
+    EXPECT_TRUE(shared(6, 7));
+    EXPECT_FALSE(shared(0, 6)) << "the right channels differ";
+    EXPECT_FALSE(shared(4, 6));
+}
+
+TEST_F(DedupeTest, LinksAndTypesKept) {
+    ASSERT_NO_FATAL_FAILURE(convert(true, true));
+    for (int i = 0; i < 8; ++i) {
+        const Sample &s = converted->sample(i);
+        EXPECT_TRUE(s.sampletype & 0x10) << i;
+    }
+    EXPECT_EQ(converted->sample(2).sampleLink, 3);
+    EXPECT_EQ(converted->sample(2).sampletype & 0xf, 2);
+    EXPECT_EQ(converted->sample(3).sampleLink, 2);
+    EXPECT_EQ(converted->sample(3).sampletype & 0xf, 4);
+}
+
+TEST_F(DedupeTest, WithoutDedupe) {
+    ASSERT_NO_FATAL_FAILURE(convert(true, false));
+    EXPECT_TRUE(shared(0, 1));
+    EXPECT_TRUE(shared(2, 3));
+    EXPECT_FALSE(shared(0, 3));
+    EXPECT_FALSE(shared(4, 5));
+}
+
+TEST_F(DedupeTest, MonoStreams) {
+    ASSERT_NO_FATAL_FAILURE(convert(false, true));
+    for (int i : {3, 4, 5, 6})
+        EXPECT_TRUE(shared(0, i)) << i;
+    EXPECT_TRUE(shared(1, 2));
+    EXPECT_FALSE(shared(0, 1));
+    EXPECT_FALSE(shared(1, 7));
+}
+
+TEST_F(DedupeTest, DecodesToTheSource) {
+    ASSERT_NO_FATAL_FAILURE(convert(true, true));
+    SoundFont sf(source.string());
+    ASSERT_TRUE(sf.read());
+    ASSERT_TRUE(sf.openSamples());
+    ASSERT_TRUE(converted->openSamples());
+    for (int i = 0; i < 8; ++i) {
+        SamplePcm in = sf.loadSample(i);
+        SamplePcm out = converted->loadSample(i);
+        ASSERT_EQ(in.pcm.size(), out.pcm.size()) << i;
+    }
+}
@@ -0,0 +1,51 @@
+#include "sfont/pcmconvert.h"
+
+#include <gtest/gtest.h>
+#include <random>
+#include <vector>
+
+//---------------------------------------------------------
+//   Every kernel gives the same floats as the scalar loop,
+//   for lengths around the vector widths and gains that clip
+//---------------------------------------------------------
+
+TEST(PcmToFloat, KernelsMatchScalar) {
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> value(-32768, 32767);
+    std::vector<int16_t> in(4099);
+    for (int16_t &v : in)
+        v = value(rng);
+    in[0] = -32768;
+    in[1] = 32767;
+
+    for (const PcmKernel &kernel : pcmToFloatKernels()) {
+        for (float gain : {1 / 32768.f, 0.5f / 32768.f, 2 / 32768.f, 1.41f / 32768.f}) {
+            for (size_t n : {0, 1, 7, 8, 9, 15, 16, 17, 31, 32, 33, 100, 4099}) {
+                std::vector<float> out(n + 1, 7.f);
+                std::vector<float> scalar(n + 1, 7.f);
+                kernel.fn(in.data(), out.data(), n, gain);
+                pcmToFloatScalar(in.data(), scalar.data(), n, gain);
+                for (size_t i = 0; i < n; ++i)
+                    ASSERT_EQ(out[i], scalar[i]) << kernel.name << " n " << n << " i " << i;
+                EXPECT_EQ(out[n], 7.f) << kernel.name << " wrote past n " << n;
+            }
+        }
+    }
+}
+
+TEST(PcmToFloat, Clips) {
+    int16_t in[2] = {-32768, 32767};
+    for (const PcmKernel &kernel : pcmToFloatKernels()) {
+        float out[2];
+        kernel.fn(in, out, 2, 4 / 32768.f);
+        EXPECT_EQ(out[0], -1.f) << kernel.name;
+        EXPECT_EQ(out[1], 1.f) << kernel.name;
+    }
+}
+
+TEST(PcmToFloat, ChosenKernelIsListed) {
+    bool found = false;
+    for (const PcmKernel &kernel : pcmToFloatKernels())
+        found |= std::string(kernel.name) == pcmToFloatKernel();
+    EXPECT_TRUE(found);
+}
@@ -0,0 +1,99 @@
+#include "sfont/riffindex.h"
+#include "sfont/riffwriter.h"
+
+#include <gtest/gtest.h>
+#include <sstream>
+
+//---------------------------------------------------------
+//   riffFile
+//    A form with an INFO list holding an odd length chunk
+//    between two even ones, and a pdta list after it
+//---------------------------------------------------------
+
+static std::string riffFile() {
+    std::ostringstream out;
+    RiffWriter w(&out);
+    size_t riff = w.beginChunk("RIFF");
+    w.write("sfbk", 4);
+    size_t list = w.beginChunk("LIST");
+    w.write("INFO", 4);
+    size_t chunk = w.beginChunk("ifil");
+    w.writeDword(0x00010002);
+    w.endChunk(chunk);
+    chunk = w.beginChunk("ICMT");
+    w.write("odd", 3);
+    w.endChunk(chunk);
+    chunk = w.beginChunk("ISFT");
+    w.write("tool", 4);
+    w.endChunk(chunk);
+    w.endChunk(list);
+    list = w.beginChunk("LIST");
+    w.write("pdta", 4);
+    chunk = w.beginChunk("phdr");
+    w.write("x", 1);
+    w.endChunk(chunk);
+    w.endChunk(list);
+    w.endChunk(riff);
+    w.close();
+    return out.str();
+}
+
+TEST(RiffWriter, PadsOddChunks) {
+    std::string data = riffFile();
+    EXPECT_EQ(data.size() % 2, 0u);
+    size_t pos = data.find("ICMT");
+    ASSERT_NE(pos, std::string::npos);
+    EXPECT_EQ(data[pos + 4], 3); // the length does not count the pad
+    EXPECT_EQ(data[pos + 11], 0);
+    EXPECT_EQ(data.compare(pos + 12, 4, "ISFT"), 0);
+}
+
+TEST(RiffIndex, SkipsPadBytes) {
+    std::istringstream in(riffFile());
+    RiffIndex index;
+    index.build(&in);
+
+    int odd = index.find("ICMT", "INFO");
+    ASSERT_GE(odd, 0);
+    EXPECT_EQ(index[odd].length, 3u);
+    int next = index.find("ISFT", "INFO");
+    ASSERT_GE(next, 0);
+    EXPECT_EQ(index[next].offset, index[odd].offset + 4 + 8);
+    EXPECT_EQ(index[next].length, 4u);
+
+    int pdta = index.find("pdta");
+    ASSERT_GE(pdta, 0);
+    EXPECT_TRUE(index[pdta].list);
+    int phdr = index.find("phdr", "pdta");
+    ASSERT_GE(phdr, 0);
+    EXPECT_EQ(index[phdr].parent, pdta);
+    EXPECT_EQ(index[phdr].length, 1u);
+    EXPECT_EQ(index.children(index.find("INFO")).size(), 3u);
+}
+
+TEST(RiffIndex, PadOfLastChunkInParent) {
+    // The pad of a LIST's last chunk ends the LIST, the next LIST follows
+    std::istringstream in(riffFile());
+    RiffIndex index;
+    index.build(&in);
+    int info = index.find("INFO");
+    int pdta = index.find("pdta");
+    ASSERT_GE(info, 0);
+    ASSERT_GE(pdta, 0);
+    EXPECT_EQ(index[pdta].offset, index[info].offset + index[info].length + 12);
+}
+
+TEST(RiffIndex, ChunkPastItsParentThrows) {
+    std::string data = riffFile();
+    size_t pos = data.find("ISFT");
+    data[pos + 4] = 100;
+    std::istringstream in(data);
+    RiffIndex index;
+    EXPECT_THROW(index.build(&in), std::string);
+}
+
+TEST(RiffIndex, NotRiffThrows) {
+    std::istringstream in(std::string("RIFX\0\0\0\0sfbk", 12));
+    RiffIndex index;
+    EXPECT_THROW(index.build(&in), std::string);
+}
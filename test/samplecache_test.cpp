@@ -0,0 +1,153 @@
+#include "sfont/samplecache.h"
+
+#include <gtest/gtest.h>
+#include <vorbis/codec.h>
+
+#include <filesystem>
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+//---------------------------------------------------------
+//   oggStream
+//    One packet of the given size in whole Ogg pages
+//---------------------------------------------------------
+
+static OggChunks oggStream(size_t bytes, int serial) {
+    std::vector<unsigned char> body(bytes, (unsigned char)serial);
+    ogg_stream_state os;
+    ogg_stream_init(&os, serial);
+    ogg_packet op{};
+    op.packet = body.data();
+    op.bytes = body.size();
+    op.b_o_s = 1;
+    op.e_o_s = 1;
+    op.granulepos = bytes;
+    ogg_stream_packetin(&os, &op);
+    OggChunks chunks;
+    ogg_page og;
+    while (ogg_stream_flush(&os, &og)) {
+        std::vector<char> page((const char *)og.header, (const char *)og.header + og.header_len);
+        page.insert(page.end(), (const char *)og.body, (const char *)og.body + og.body_len);
+        chunks.push_back(std::move(page));
+    }
+    ogg_stream_clear(&os);
+    return chunks;
+}
+
+static std::vector<char> joined(const OggChunks &chunks) {
+    std::vector<char> data;
+    for (const std::vector<char> &chunk : chunks)
+        data.insert(data.end(), chunk.begin(), chunk.end());
+    return data;
+}
+
+static std::string cacheKey(int n) {
+    std::vector<int16_t> pcm(100, n);
+    return SampleCache::key(pcm, {}, 44100, 0.3, 0);
+}
+
+//---------------------------------------------------------
+//   SampleCacheTest
+//    Every test gets an empty cache directory
+//---------------------------------------------------------
+
+class SampleCacheTest : public ::testing::Test {
+  protected:
+    fs::path dir;
+
+    void SetUp() override {
+        dir = fs::temp_directory_path() /
+              ("sftools-cache-" + std::string(
+                                      ::testing::UnitTest::GetInstance()->current_test_info()->name()));
+        fs::remove_all(dir);
+    }
+    void TearDown() override { fs::remove_all(dir); }
+
+    fs::path entryFile(const std::string &key) { return dir / key.substr(0, 2) / (key + ".ogg"); }
+};
+
+TEST_F(SampleCacheTest, MissThenHit) {
+    SampleCache cache(dir.string(), 1 << 20);
+    ASSERT_TRUE(cache.open());
+    std::string key = cacheKey(1);
+    ChunkSink miss;
+    EXPECT_FALSE(cache.load(key, miss));
+    EXPECT_EQ(miss.size(), 0u);
+
+    OggChunks data = oggStream(5000, 1);
+    cache.store(key, data);
+    ChunkSink hit;
+    ASSERT_TRUE(cache.load(key, hit));
+    EXPECT_EQ(joined(hit.take()), joined(data));
+}
+
+TEST_F(SampleCacheTest, KeyCoversSettings) {
+    std::vector<int16_t> pcm(100, 1);
+    std::string key = SampleCache::key(pcm, {}, 44100, 0.3, 0);
+    EXPECT_EQ(key.size(), 32u);
+    EXPECT_EQ(key, SampleCache::key(pcm, {}, 44100, 0.3, 0));
+    EXPECT_NE(key, SampleCache::key(pcm, {}, 44100, 0.4, 0));
+    EXPECT_NE(key, SampleCache::key(pcm, {}, 22050, 0.3, 0));
+    EXPECT_NE(key, SampleCache::key(pcm, {}, 44100, 0.3, 3));
+    EXPECT_NE(key, SampleCache::key(pcm, pcm, 44100, 0.3, 0));
+}
+
+TEST_F(SampleCacheTest, TruncatedEntryIsAMiss) {
+    SampleCache cache(dir.string(), 1 << 20);
+    ASSERT_TRUE(cache.open());
+    std::string key = cacheKey(2);
+    cache.store(key, oggStream(5000, 2));
+    fs::path file = entryFile(key);
+    ASSERT_TRUE(fs::exists(file));
+    fs::resize_file(file, fs::file_size(file) - 10);
+
+    ChunkSink sink;
+    EXPECT_FALSE(cache.load(key, sink));
+    EXPECT_FALSE(fs::exists(file));
+}
+
+TEST_F(SampleCacheTest, TrailingGarbageIsAMiss) {
+    SampleCache cache(dir.string(), 1 << 20);
+    ASSERT_TRUE(cache.open());
+    std::string key = cacheKey(3);
+    cache.store(key, oggStream(5000, 3));
+    std::ofstream(entryFile(key), std::ios::binary | std::ios::app) << "junk";
+
+    ChunkSink sink;
+    EXPECT_FALSE(cache.load(key, sink));
+}
+
+TEST_F(SampleCacheTest, TrimEvictsLeastRecentlyUsed) {
+    OggChunks data = oggStream(5000, 4);
+    size_t entryBytes = joined(data).size();
+    SampleCache cache(dir.string(), 2 * entryBytes);
+    ASSERT_TRUE(cache.open());
+    auto now = fs::file_time_type::clock::now();
+    for (int i = 0; i < 3; ++i) {
+        cache.store(cacheKey(10 + i), data);
+        fs::last_write_time(entryFile(cacheKey(10 + i)), now - std::chrono::hours(3 - i));
+    }
+    cache.trim();
+    EXPECT_FALSE(fs::exists(entryFile(cacheKey(10))));
+    EXPECT_TRUE(fs::exists(entryFile(cacheKey(11))));
+    EXPECT_TRUE(fs::exists(entryFile(cacheKey(12))));
+
+    // A hit refreshes the entry, so the next trim drops the other one
+    ChunkSink sink;
+    ASSERT_TRUE(cache.load(cacheKey(11), sink));
+    cache.store(cacheKey(13), data);
+    cache.trim();
+    EXPECT_TRUE(fs::exists(entryFile(cacheKey(11))));
+    EXPECT_FALSE(fs::exists(entryFile(cacheKey(12))));
+    EXPECT_TRUE(fs::exists(entryFile(cacheKey(13))));
+}
+
+TEST_F(SampleCacheTest, NoTemporaryFilesLeft) {
+    SampleCache cache(dir.string(), 1 << 20);
+    ASSERT_TRUE(cache.open());
+    for (int i = 0; i < 8; ++i)
+        cache.store(cacheKey(20 + i), oggStream(1000, i));
+    for (const auto &entry : fs::recursive_directory_iterator(dir))
+        EXPECT_NE(entry.path().extension(), ".tmp") << entry.path();
+}
@@ -0,0 +1,145 @@
+#include "testfont.h"
+#include "sfont/riffwriter.h"
+#include "sfont/sfont.h"
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+//---------------------------------------------------------
+//   writeName
+//---------------------------------------------------------
+
+static void writeName(RiffWriter &w, const char *name) {
+    char buffer[20]{};
+    strncpy(buffer, name, 19);
+    w.write(buffer, 20);
+}
+
+//---------------------------------------------------------
+//   testTone
+//---------------------------------------------------------
+
+std::vector<int16_t> testTone(int frames, unsigned seed) {
+    std::vector<int16_t> pcm(frames);
+    double freq = 110.0 * (1 + seed % 12);
+    for (int i = 0; i < frames; ++i) {
+        double t = i / 44100.0;
+        pcm[i] = lrint(8000 * sin(2 * M_PI * freq * t) * exp(-3.0 * t));
+    }
+    return pcm;
+}
+
+//---------------------------------------------------------
+//   writeTestFont
+//---------------------------------------------------------
+
+bool writeTestFont(const std::string &path, const std::vector<TestSample> &samples) {
+    std::ofstream f(path, std::ios::out | std::ios::binary);
+    if (!f)
+        return false;
+    static const char zero[26] = {};
+    static const int16_t silence[46] = {};
+    RiffWriter w(&f);
+    try {
+        size_t riff = w.beginChunk("RIFF");
+        w.write("sfbk", 4);
+
+        size_t list = w.beginChunk("LIST");
+        w.write("INFO", 4);
+        size_t chunk = w.beginChunk("ifil");
+        w.writeWord(2);
+        w.writeWord(1);
+        w.endChunk(chunk);
+        w.endChunk(list);
+
+        list = w.beginChunk("LIST");
+        w.write("sdta", 4);
+        chunk = w.beginChunk("smpl");
+        std::vector<unsigned> start;
+        unsigned pos = 0;
+        for (const TestSample &s : samples) {
+            w.write((const char *)s.pcm.data(), s.pcm.size() * 2);
+            w.write((const char *)silence, sizeof(silence));
+            start.push_back(pos);
+            pos += s.pcm.size() + 46;
+        }
+        w.endChunk(chunk);
+        w.endChunk(list);
+
+        list = w.beginChunk("LIST");
+        w.write("pdta", 4);
+        chunk = w.beginChunk("phdr");
+        for (int i = 0; i < 2; ++i) {
+            writeName(w, i ? "EOP" : "Preset");
+            w.writeWord(0);
+            w.writeWord(0);
+            w.writeWord(i);
+            w.write(zero, 12);
+        }
+        w.endChunk(chunk);
+        chunk = w.beginChunk("pbag");
+        for (int i = 0; i < 2; ++i) {
+            w.writeWord(i);
+            w.writeWord(0);
+        }
+        w.endChunk(chunk);
+        chunk = w.beginChunk("pmod");
+        w.write(zero, 10);
+        w.endChunk(chunk);
+        chunk = w.beginChunk("pgen");
+        w.writeWord(Gen_Instrument);
+        w.writeWord(0);
+        w.writeDword(0);
+        w.endChunk(chunk);
+
+        chunk = w.beginChunk("inst");
+        for (int i = 0; i < 2; ++i) {
+            writeName(w, i ? "EOI" : "Instrument");
+            w.writeWord(i * samples.size());
+        }
+        w.endChunk(chunk);
+        chunk = w.beginChunk("ibag");
+        for (size_t i = 0; i <= samples.size(); ++i) {
+            w.writeWord(i);
+            w.writeWord(0);
+        }
+        w.endChunk(chunk);
+        chunk = w.beginChunk("imod");
+        w.write(zero, 10);
+        w.endChunk(chunk);
+        chunk = w.beginChunk("igen");
+        for (size_t i = 0; i < samples.size(); ++i) {
+            w.writeWord(Gen_SampleId);
+            w.writeWord(i);
+        }
+        w.writeDword(0);
+        w.endChunk(chunk);
+
+        chunk = w.beginChunk("shdr");
+        for (size_t i = 0; i < samples.size(); ++i) {
+            unsigned s = start[i];
+            unsigned e = s + samples[i].pcm.size();
+            writeName(w, ("Sample " + std::to_string(i)).c_str());
+            w.writeDword(s);
+            w.writeDword(e);
+            w.writeDword(s);
+            w.writeDword(e - 1);
+            w.writeDword(44100);
+            unsigned char pitch[2] = {60, 0};
+            w.write((const char *)pitch, 2);
+            w.writeWord(samples[i].link);
+            w.writeWord(samples[i].type);
+        }
+        writeName(w, "EOS");
+        w.write(zero, 26);
+        w.endChunk(chunk);
+        w.endChunk(list);
+
+        w.endChunk(riff);
+        w.close();
+    } catch (std::string s) {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//---------------------------------------------------------
+//   TestSample
+//---------------------------------------------------------
+
+struct TestSample {
+    std::vector<int16_t> pcm;
+    int link{0};
+    int type{1}; // 1 mono, 2 right, 4 left
+};
+
+//---------------------------------------------------------
+//   writeTestFont
+//    Write a SoundFont2 file with the given samples, played
+//    by one instrument with a zone per sample and one preset
+//---------------------------------------------------------
+
+bool writeTestFont(const std::string &path, const std::vector<TestSample> &);
+
+// A decaying tone of the given frames, different for every seed
+std::vector<int16_t> testTone(int frames, unsigned seed);